@@ -5,54 +5,211 @@
 #include <iostream>
 #include <vector>
 #include <limits>
+#include <cstdint>
+#include <algorithm>
+#include <memory>
+#include <cstring>
+#include <cctype>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "life_kernels.hpp"
+#include "thread_team.hpp"
 
 
 inline int MOD(int a, int b) {
     return (a%b+b) % b;
 }
 
+// Coordinates inside [0, n) are used as they are, only those outside pay for the divisions in MOD
+inline size_t wrap_index(int i, size_t n) {
+    return (i >= 0 && static_cast<size_t>(i) < n) ? i : MOD(i, n);
+}
+
+// Copies `count` bits from bit src_bit of src to bit dst_bit of dst, bit i of an array of words being
+// bit (i & 63) of word (i >> 6). Works a word at a time.
+inline void copy_bits(uint64_t* dst, size_t dst_bit, const uint64_t* src, size_t src_bit, size_t count) {
+    while (count > 0) {
+        const size_t n = std::min({count, 64 - (dst_bit & 63), 64 - (src_bit & 63)});
+        const uint64_t mask = (n == 64) ? ~uint64_t(0) : (uint64_t(1) << n) - 1;
+        const uint64_t bits = (src[src_bit >> 6] >> (src_bit & 63)) & mask;
+        uint64_t& word = dst[dst_bit >> 6];
+        word = (word & ~(mask << (dst_bit & 63))) | (bits << (dst_bit & 63));
+        dst_bit += n;
+        src_bit += n;
+        count -= n;
+    }
+}
+
+// Writes `count` bits from bit src_bit of src as bytes of 0 and 1, as in a PGM image. Eight bits at a
+// time: the byte is broadcast to the eight bytes of a word, byte k keeps bit k, and adding 0x7f carries
+// into the top bit of the bytes that are not zero.
+inline void expand_bits(unsigned char* dst, const uint64_t* src, size_t src_bit, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const size_t bit = src_bit + i, shift = bit & 63;
+        uint64_t byte = src[bit >> 6] >> shift;
+        if (shift > 56) byte |= src[(bit >> 6) + 1] << (64 - shift);
+        uint64_t bytes = ((byte & 0xff) * 0x0101010101010101ULL) & 0x8040201008040201ULL;
+        bytes = ((bytes + 0x7f7f7f7f7f7f7f7fULL) & 0x8080808080808080ULL) >> 7;
+        memcpy(dst + i, &bytes, sizeof(bytes)); // little endian: byte k of the word is dst[i + k]
+    }
+    for (; i < count; i++) {
+        dst[i] = (src[(src_bit + i) >> 6] >> ((src_bit + i) & 63)) & 1;
+    }
+}
+
+// The reverse of expand_bits: sets `count` bits from bit dst_bit of dst, a bit for every byte of src
+// that is not zero. Eight bytes at a time: the top bit of each byte is set if the byte is not zero,
+// and a multiply gathers the eight top bits into the top byte of the word.
+inline void pack_bytes(uint64_t* dst, size_t dst_bit, const unsigned char* src, size_t count) {
+    for (size_t i = 0; i < count; i += 64) {
+        const size_t n = std::min<size_t>(count - i, 64);
+        uint64_t word = 0;
+        size_t j = 0;
+        for (; j + 8 <= n; j += 8) {
+            uint64_t bytes;
+            memcpy(&bytes, src + i + j, sizeof(bytes));
+            bytes = (((bytes & 0x7f7f7f7f7f7f7f7fULL) + 0x7f7f7f7f7f7f7f7fULL) | bytes) & 0x8080808080808080ULL;
+            word |= ((bytes >> 7) * 0x0102040810204080ULL >> 56) << j;
+        }
+        for (; j < n; j++) {
+            word |= uint64_t(src[i + j] != 0) << j;
+        }
+        copy_bits(dst, dst_bit + i, &word, 0, n);
+    }
+}
+
+// PBM (P4) rows hold eight pixels per byte with the first one in the top bit, and Grid rows hold eight
+// cells per byte with the first one in the lowest bit, so a row converts by reversing every byte
+inline uint64_t reverse_bits_in_bytes(uint64_t x) {
+    x = ((x >> 1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) << 1);
+    x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+    return ((x >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((x & 0x0f0f0f0f0f0f0f0fULL) << 4);
+}
+
+// Converts a PBM row of `cols` pixels into the words of a Grid row, with the padding bits cleared.
+// src may be the row itself, read straight into the Grid.
+inline void pbm_to_bits(uint64_t* dst, const unsigned char* src, size_t cols) {
+    const size_t words = (cols + 63) >> 6, bytes = (cols + 7) >> 3;
+    if (words == 0) return;
+    memmove(dst, src, bytes);
+    memset(reinterpret_cast<unsigned char*>(dst) + bytes, 0, words * sizeof(uint64_t) - bytes);
+    for (size_t w = 0; w < words; w++) dst[w] = reverse_bits_in_bytes(dst[w]);
+    if (cols & 63) dst[words - 1] &= (uint64_t(1) << (cols & 63)) - 1;
+}
+
+// Converts the words of a Grid row of `cols` cells into a PBM row of (cols + 7) / 8 bytes
+inline void bits_to_pbm(unsigned char* dst, const uint64_t* src, size_t cols) {
+    const size_t bytes = (cols + 7) >> 3;
+    for (size_t w = 0; w << 3 < bytes; w++) {
+        const uint64_t reversed = reverse_bits_in_bytes(src[w]);
+        memcpy(dst + (w << 3), &reversed, std::min<size_t>(8, bytes - (w << 3)));
+    }
+}
+
+// A whole file mapped read-only, so images are packed straight from the page cache without a copy
+struct MappedFile {
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+
+    explicit MappedFile(const std::string& filename) {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::ios_base::failure("Failed to open file");
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            throw std::ios_base::failure("Failed to stat file");
+        }
+        size = info.st_size;
+        if (size > 0) {
+            void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                close(fd);
+                throw std::ios_base::failure("Failed to map file");
+            }
+            madvise(mapping, size, MADV_SEQUENTIAL); // only a hint, read ahead aggressively
+            data = static_cast<const unsigned char*>(mapping);
+        }
+        close(fd); // the mapping stays valid
+    }
+
+    ~MappedFile() {
+        if (data) munmap(const_cast<unsigned char*>(data), size);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
+// Reads the next decimal field of a PNM header at pos, skipping whitespace and '#' comments before it
+inline size_t pnm_header_field(const MappedFile& file, size_t& pos) {
+    while (pos < file.size && (isspace(file.data[pos]) || file.data[pos] == '#')) {
+        if (file.data[pos] == '#') {
+            while (pos < file.size && file.data[pos] != '\n') pos++;
+        } else {
+            pos++;
+        }
+    }
+    if (pos == file.size || !isdigit(file.data[pos])) {
+        throw std::invalid_argument("Malformed PNM header");
+    }
+    size_t value = 0;
+    while (pos < file.size && isdigit(file.data[pos])) {
+        const size_t digit = file.data[pos++] - '0';
+        if (value > (SIZE_MAX - digit) / 10) {
+            throw std::invalid_argument("PNM header field out of range");
+        }
+        value = value * 10 + digit;
+    }
+    return value;
+}
+
 
 class Grid {
-    unsigned char* grid = nullptr;
-    size_t rows, cols, element_count, _byte_count;
+    uint64_t* grid = nullptr;
+    size_t rows = 0, cols = 0, element_count = 0, _words_per_row = 0, _word_count = 0; // Each row starts at a word boundary, so that rows can be processed 64 cells at a time
 
     inline bool _get_at_bit_index(size_t _index) const {
-        return (grid[_index>>3] & (0x1 << (_index & 0x7))) != 0; // != 0 not strictly necessary, but it ensures that the bits are canonically set for bools.
+        return (grid[_index>>6] & (uint64_t(1) << (_index & 0x3f))) != 0; // != 0 not strictly necessary, but it ensures that the bits are canonically set for bools.
     }
 
     inline void _set_at_bit_index(size_t _index, bool _val) {
-        grid[_index>>3] &= ~(0x1 << (_index & 0x7));
-        grid[_index>>3] |= ((_val != 0) & 0x1) << (_index & 0x7);
+        grid[_index>>6] &= ~(uint64_t(1) << (_index & 0x3f));
+        grid[_index>>6] |= uint64_t((_val != 0) & 0x1) << (_index & 0x3f);
     }
 
     inline size_t _to_index(int _row, int _col) const {
-        return MOD(_row, rows)*cols + MOD(_col, cols);
+        return wrap_index(_row, rows)*(_words_per_row << 6) + wrap_index(_col, cols);
     }
 
 public:
     Grid(size_t rows, size_t cols)
-        : rows(rows), cols(cols) , element_count(rows * cols) {
-        _byte_count = 1 + (element_count / 8);
-        grid = new unsigned char[_byte_count];
-        for (size_t i = 0; i < _byte_count; i++) {
+        : rows(rows), cols(cols) , element_count(rows * cols), _words_per_row(words_per_row(cols)), _word_count(rows * _words_per_row) {
+        grid = new uint64_t[_word_count];
+        for (size_t i = 0; i < _word_count; i++) {
             grid[i] = 0;
         }
     }
-    Grid(size_t rows, size_t cols, const unsigned char* data) // Be very careful with this constructor, it does not check if the data is valid and also does no copying. _byte_count is also left uninitialized.
-        : rows(rows), cols(cols), element_count(rows * cols), grid(const_cast<unsigned char*>(data)) {}
+    Grid(size_t rows, size_t cols, const unsigned char* data) // Be very careful with this constructor, it does not check if the data is valid (word aligned, rows padded to whole words) and also does no copying.
+        : grid(reinterpret_cast<uint64_t*>(const_cast<unsigned char*>(data))), rows(rows), cols(cols), element_count(rows * cols), _words_per_row(words_per_row(cols)), _word_count(rows * _words_per_row) {}
     Grid() {}
     ~Grid() {
         if (grid) delete[] grid; // grid might be null because of the default constructor
     }
 
-    Grid(const Grid& other) : rows(other.rows), cols(other.cols), element_count(other.element_count), _byte_count(other._byte_count) {
-        grid = new unsigned char[_byte_count];
-        for (size_t i = 0; i < _byte_count; i++) {
+    Grid(const Grid& other) : rows(other.rows), cols(other.cols), element_count(other.element_count), _words_per_row(other._words_per_row), _word_count(other._word_count) {
+        grid = new uint64_t[_word_count];
+        for (size_t i = 0; i < _word_count; i++) {
             grid[i] = other.grid[i];
         }
     }
 
-    Grid(Grid&& other) : rows(other.rows), cols(other.cols), element_count(other.element_count), _byte_count(other._byte_count) {
+    Grid(Grid&& other) : rows(other.rows), cols(other.cols), element_count(other.element_count), _words_per_row(other._words_per_row), _word_count(other._word_count) {
         grid = other.grid;
         other.grid = nullptr;
     }
@@ -63,9 +220,10 @@ public:
         rows = other.rows;
         cols = other.cols;
         element_count = other.element_count;
-        _byte_count = other._byte_count;
-        grid = new unsigned char[_byte_count];
-        for (size_t i = 0; i < _byte_count; i++) {
+        _words_per_row = other._words_per_row;
+        _word_count = other._word_count;
+        grid = new uint64_t[_word_count];
+        for (size_t i = 0; i < _word_count; i++) {
             grid[i] = other.grid[i];
         }
         return *this;
@@ -77,12 +235,23 @@ public:
         rows = other.rows;
         cols = other.cols;
         element_count = other.element_count;
-        _byte_count = other._byte_count;
+        _words_per_row = other._words_per_row;
+        _word_count = other._word_count;
         grid = other.grid;
         other.grid = nullptr;
         return *this;
     }
 
+    // Number of 64 bit words needed to store a row of the given length
+    static size_t words_per_row(size_t cols) {
+        return (cols + 63) >> 6;
+    }
+
+    // Number of bytes the storage of a rows x cols grid occupies
+    static size_t byte_count(size_t rows, size_t cols) {
+        return rows * words_per_row(cols) * sizeof(uint64_t);
+    }
+
      bool get(int row, int col) const {
         return _get_at_bit_index(_to_index(row, col));
     }
@@ -93,9 +262,16 @@ public:
 
     size_t no_neighbors(int row, int col) const {
         size_t count = 0;
-        const std::vector<int> d({-1,0,1});
-        for (auto& dx : d) for (auto& dy : d) {
-            count += get(row + dx, col + dy) & 1;
+        if (row > 0 && row + 1 < static_cast<int>(rows) && col > 0 && col + 1 < static_cast<int>(cols)) {
+            // interior cell, the neighborhood does not wrap around
+            size_t index = (row - 1) * (_words_per_row << 6) + (col - 1);
+            for (int dx = -1; dx <= 1; dx++, index += _words_per_row << 6) {
+                count += _get_at_bit_index(index) + _get_at_bit_index(index + 1) + _get_at_bit_index(index + 2);
+            }
+        } else {
+            for (int dx = -1; dx <= 1; dx++) for (int dy = -1; dy <= 1; dy++) {
+                count += get(row + dx, col + dy) & 1;
+            }
         }
         return count - (get(row, col) & 1); // middle cell is not a neighbor
     }
@@ -113,13 +289,21 @@ public:
     }
 
     const unsigned char* data() const {
-        return grid;
+        return reinterpret_cast<const unsigned char*>(grid);
     }
 
     size_t size() const {
-        return _byte_count;
+        return _word_count * sizeof(uint64_t);
     }
 
+    size_t get_rows() const { return rows; }
+    size_t get_cols() const { return cols; }
+    size_t words_per_row() const { return _words_per_row; }
+
+    // Raw access to the words of a row (no wraparound). Bits past the last column must stay zero.
+    uint64_t* row_data(size_t row) { return grid + row * _words_per_row; }
+    const uint64_t* row_data(size_t row) const { return grid + row * _words_per_row; }
+
     void _nullify() { grid = nullptr; } // Call this function to prevent the destructor from deleting the data
 
     Grid subgrid(int start_row, int start_col, int end_row, int end_col) const {
@@ -173,19 +357,187 @@ public:
 };
 
 
+// Activity of the tiles of a board, a tile being 64 rows high and one word (64 columns) wide.
+// A tile that did not change in the last generation, and whose eight neighbor tiles did not change
+// either, cannot change in the next one, so it is skipped by the tick.
+struct ActiveTiles {
+    static const size_t TILE_ROWS = 64;
+
+    size_t tile_rows = 0, tile_cols = 0;
+    std::vector<unsigned char> changed;      // tiles changed in the last generation (or by set)
+    std::vector<unsigned char> next_changed; // tiles changed by the generation being computed
+    std::vector<unsigned char> computed;     // tiles computed by the generation, by any of its regions
+    bool enabled = true;
+    size_t last_skipped = 0;
+
+    ActiveTiles() {}
+    ActiveTiles(size_t rows, size_t cols) {
+        reset(rows, cols);
+    }
+
+    void reset(size_t rows, size_t cols) {
+        tile_rows = (rows + TILE_ROWS - 1) / TILE_ROWS;
+        tile_cols = Grid::words_per_row(cols);
+        changed.assign(tile_rows * tile_cols, 1);
+        next_changed.assign(tile_rows * tile_cols, 0);
+        computed.assign(tile_rows * tile_cols, 0);
+    }
+
+    void mark(size_t row, size_t col) {
+        changed[(row / TILE_ROWS) * tile_cols + (col >> 6)] = 1;
+    }
+
+    void mark_row(size_t row) {
+        std::fill(changed.begin() + (row / TILE_ROWS) * tile_cols, changed.begin() + (row / TILE_ROWS + 1) * tile_cols, 1);
+    }
+
+    void mark_col(size_t col) {
+        for (size_t t = 0; t < tile_rows; t++) changed[t * tile_cols + (col >> 6)] = 1;
+    }
+
+    void mark_all() {
+        std::fill(changed.begin(), changed.end(), 1);
+    }
+
+    // Active flags of the tiles in tile row t: the tile or one of its neighbors (wrapping around) changed
+    void find_active(size_t t, std::vector<unsigned char>& active) const {
+        if (tile_cols == 0) return;
+        if (!enabled) {
+            std::fill(active.begin(), active.end(), 1);
+            return;
+        }
+        const unsigned char* up = &changed[(t == 0 ? tile_rows - 1 : t - 1) * tile_cols];
+        const unsigned char* mid = &changed[t * tile_cols];
+        const unsigned char* down = &changed[(t + 1 == tile_rows ? 0 : t + 1) * tile_cols];
+        for (size_t w = 0; w < tile_cols; w++) active[w] = up[w] | mid[w] | down[w];
+        unsigned char first = active[0], prev = active[tile_cols - 1];
+        for (size_t w = 0; w < tile_cols; w++) {
+            unsigned char cur = active[w];
+            active[w] = prev | cur | ((w + 1 < tile_cols) ? active[w + 1] : first);
+            prev = cur;
+        }
+    }
+
+    // Called when the generation is complete. A tile is skipped if no region of the generation computed
+    // it, however the generation was split into regions.
+    void finish() {
+        changed.swap(next_changed);
+        std::fill(next_changed.begin(), next_changed.end(), 0);
+        last_skipped = std::count(computed.begin(), computed.end(), 0);
+        std::fill(computed.begin(), computed.end(), 0);
+    }
+};
+
+
 class GameOfLife {
     Grid state, next_state;
     size_t rows, cols, element_count;
+    TickKernel kernel = TickKernel::Auto;
+    LifeRowFunction row_kernel = row_function(TickKernel::Auto);
+    ActiveTiles tiles;
+    std::unique_ptr<ThreadTeam> team; // only with more than one thread
+
+    // Buffers of one band of the tick, kept between ticks so that a tick does not allocate
+    struct TickScratch {
+        std::vector<unsigned char> active;
+        std::vector<uint64_t> changes;
+    };
+    std::vector<TickScratch> scratch;
+
+    // Empty grids of a new size, for the image readers
+    void _resize(size_t _rows, size_t _cols) {
+        rows = _rows;
+        cols = _cols;
+        state = Grid(rows, cols);
+        next_state = Grid(rows, cols);
+        element_count = rows * cols;
+        tiles.reset(rows, cols);
+    }
+
+    // Row i of the current state, rows -1 and `rows` wrap around
+    const uint64_t* _wrapped_row(size_t i) const {
+        return state.row_data(i == size_t(-1) ? rows - 1 : (i == rows ? 0 : i));
+    }
+
+    // Computes the words [word_begin, word_end) of the rows [row_begin, row_end) of the next generation.
+    // The changed bits of each word column are ORed into changes.
+    void _compute_rows(size_t row_begin, size_t row_end, size_t word_begin, size_t word_end, uint64_t* changes) {
+        const size_t words = state.words_per_row();
+        size_t i = row_begin;
+        if (kernel == TickKernel::Table) {
+            // pairs of rows with the 4x4 lookup table, an odd last row with the 3x3 table
+            for (; i + 1 < row_end; i += 2) {
+                life_row_pair_table(_wrapped_row(i - 1), state.row_data(i), state.row_data(i + 1), _wrapped_row(i + 2),
+                                    next_state.row_data(i), next_state.row_data(i + 1), word_begin, word_end, words, cols, changes);
+            }
+        }
+        for (; i < row_end; i++) {
+            row_kernel(_wrapped_row(i - 1), state.row_data(i), _wrapped_row(i + 1), next_state.row_data(i), word_begin, word_end, words, cols, changes);
+        }
+    }
+
+    // Computes the words [word_begin, word_end) of the rows [row_begin, row_end) of the next generation into
+    // next_state, skipping inactive tiles. The computed tiles are flagged for the skipped tile count.
+    void _tick_rows(size_t row_begin, size_t row_end, size_t word_begin, size_t word_end, TickScratch& buffers) {
+        std::vector<unsigned char>& active = buffers.active;
+        std::vector<uint64_t>& changes = buffers.changes;
+        for (size_t t = row_begin / ActiveTiles::TILE_ROWS; t * ActiveTiles::TILE_ROWS < row_end; t++) {
+            const size_t band_begin = std::max(row_begin, t * ActiveTiles::TILE_ROWS);
+            const size_t band_end = std::min(row_end, (t + 1) * ActiveTiles::TILE_ROWS);
+            tiles.find_active(t, active);
+            std::fill(changes.begin(), changes.end(), 0);
+            unsigned char* computed = tiles.computed.data() + t * tiles.tile_cols;
+            for (size_t w = word_begin; w < word_end;) {
+                if (!active[w]) {
+                    w++;
+                    continue;
+                }
+                size_t run_end = w + 1;
+                while (run_end < word_end && active[run_end]) run_end++;
+                _compute_rows(band_begin, band_end, w, run_end, changes.data());
+                std::fill(computed + w, computed + run_end, 1);
+                w = run_end;
+            }
+            if (tiles.enabled) {
+                unsigned char* flags = &tiles.next_changed[t * tiles.tile_cols];
+                for (size_t w = word_begin; w < word_end; w++) flags[w] |= changes[w] != 0;
+            }
+        }
+    }
+
+    // Computes the rows [row_begin, row_end) with the thread team. Each thread gets a band of whole tile
+    // rows, so that no two threads write the same changed flag.
+    void _tick_bands(size_t row_begin, size_t row_end, size_t word_begin, size_t word_end) {
+        const size_t tile_begin = row_begin / ActiveTiles::TILE_ROWS;
+        const size_t tile_end = (row_end + ActiveTiles::TILE_ROWS - 1) / ActiveTiles::TILE_ROWS;
+        const size_t bands = std::max<size_t>(team ? std::min(team->size(), tile_end - tile_begin) : 1, 1);
+        if (scratch.size() < bands) scratch.resize(bands);
+        for (size_t band = 0; band < bands; band++) {
+            scratch[band].active.resize(state.words_per_row());
+            scratch[band].changes.resize(state.words_per_row());
+        }
+        if (bands == 1) {
+            _tick_rows(row_begin, row_end, word_begin, word_end, scratch[0]);
+            return;
+        }
+        team->run([&](size_t band) {
+            if (band >= bands) return;
+            const size_t band_begin = (tile_begin + band * (tile_end - tile_begin) / bands) * ActiveTiles::TILE_ROWS;
+            const size_t band_end = (tile_begin + (band + 1) * (tile_end - tile_begin) / bands) * ActiveTiles::TILE_ROWS;
+            _tick_rows(std::max(row_begin, band_begin), std::min(row_end, band_end), word_begin, word_end, scratch[band]);
+        });
+    }
+
 
 public:
     GameOfLife(size_t rows, size_t cols)
-        : state(rows, cols), next_state(rows, cols), rows(rows), cols(cols), element_count(rows * cols) {}
+        : state(rows, cols), next_state(rows, cols), rows(rows), cols(cols), element_count(rows * cols), tiles(rows, cols) {}
 
     GameOfLife() {}
     ~GameOfLife() = default;
 
-    GameOfLife(const GameOfLife& other) : state(other.state), next_state(other.next_state), rows(other.rows), cols(other.cols), element_count(other.element_count) {}
-    GameOfLife(GameOfLife&& other) : state(std::move(other.state)), next_state(std::move(other.next_state)), rows(other.rows), cols(other.cols), element_count(other.element_count) {}
+    GameOfLife(const GameOfLife& other) : state(other.state), next_state(other.next_state), rows(other.rows), cols(other.cols), element_count(other.element_count), kernel(other.kernel), row_kernel(other.row_kernel), tiles(other.tiles), team(other.team ? new ThreadTeam(other.team->size()) : nullptr) {}
+    GameOfLife(GameOfLife&& other) : state(std::move(other.state)), next_state(std::move(other.next_state)), rows(other.rows), cols(other.cols), element_count(other.element_count), kernel(other.kernel), row_kernel(other.row_kernel), tiles(std::move(other.tiles)), team(std::move(other.team)) {}
 
     GameOfLife& operator=(const GameOfLife& other) {
         if (this == &other) return *this;
@@ -194,6 +546,10 @@ public:
         rows = other.rows;
         cols = other.cols;
         element_count = other.element_count;
+        kernel = other.kernel;
+        row_kernel = other.row_kernel;
+        tiles = other.tiles;
+        team.reset(other.team ? new ThreadTeam(other.team->size()) : nullptr);
         return *this;
     }
 
@@ -204,12 +560,15 @@ public:
         rows = other.rows;
         cols = other.cols;
         element_count = other.element_count;
+        kernel = other.kernel;
+        row_kernel = other.row_kernel;
+        tiles = std::move(other.tiles);
+        team = std::move(other.team);
         return *this;
     }
 
     inline bool becomes_alive(size_t row, size_t col) const {
-        size_t no_neighbors = state.no_neighbors(row, col);
-        return (no_neighbors == 3) || (no_neighbors == 2 && state.get(row, col));
+        return life_rule(state.get(row, col), state.no_neighbors(row, col));
     }
 
     inline bool get(size_t row, size_t col) const {
@@ -218,26 +577,73 @@ public:
 
     inline void set(int row, int col, bool val) {
         state.set(row, col, val);
+        tiles.mark(wrap_index(row, rows), wrap_index(col, cols));
     }
 
     void init(std::initializer_list<std::initializer_list<size_t>>&& l) {
         for (auto& pair : l) {
-            state.set(*pair.begin(), *(pair.begin() + 1), true);
+            set(*pair.begin(), *(pair.begin() + 1), true);
         }
     }
 
+    // Selects the row kernel used by tick(). Auto picks the widest SIMD kernel the CPU supports.
+    void set_kernel(TickKernel _kernel) {
+        row_kernel = row_function(_kernel);
+        kernel = _kernel;
+    }
+
+    TickKernel get_kernel() const { return kernel; }
+
+    // Skipping of unchanged tiles, on by default. The result is the same either way.
+    void set_active_tracking(bool enabled) {
+        if (enabled && !tiles.enabled) tiles.mark_all(); // the flags were not maintained in the meantime
+        tiles.enabled = enabled;
+    }
+
+    // Number of threads used by tick(), 0 for one per hardware thread. The threads are started here
+    // and kept for all following ticks; the result does not depend on the number of threads.
+    void set_threads(size_t threads) {
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        team.reset(threads > 1 ? new ThreadTeam(threads) : nullptr);
+    }
+
+    size_t get_threads() const { return team ? team->size() : 1; }
+
+    // Computes the next generation 64 cells at a time (or more with SIMD), see life_kernels.hpp.
+    // Only tiles that changed in the last generation, or border one that did, are computed.
     void tick() {
-        for (size_t i = 0; i < rows; i++) {
-            for (size_t j = 0; j < cols; j++) {
-                next_state.set(i, j, becomes_alive(i, j));
-            }
-        }
+        _tick_bands(0, rows, 0, state.words_per_row());
+        finish_tick();
+    }
+
+    // Computes the words [word_begin, word_end) of the rows [row_begin, row_end) of the next generation.
+    // A generation can be computed as several disjoint regions, e.g. the cells that do not depend on the
+    // ghost cells while those are received, and is completed by finish_tick().
+    void tick_region(size_t row_begin, size_t row_end, size_t word_begin, size_t word_end) {
+        if (row_begin < row_end && word_begin < word_end) _tick_bands(row_begin, row_end, word_begin, word_end);
+    }
+
+    void finish_tick() {
         std::swap(state, next_state); // Swap the two Grid objects
+        tiles.finish();
     }
 
+    // Number of 64x64 tiles skipped by the last tick, out of get_tile_count()
+    size_t get_skipped_tiles() const { return tiles.last_skipped; }
+    size_t get_tile_count() const { return tiles.tile_rows * tiles.tile_cols; }
+
     void to_pgm(const std::string&) const;
     void initialize_from_pgm(const std::string&);
 
+    // PBM (P4) files, with eight cells per byte
+    void to_pbm(const std::string&) const;
+    void initialize_from_pbm(const std::string&);
+
+    // Run length encoded patterns (x = cols, y = rows, rule = B3/S23), read and written a run at a
+    // time, without an image of the board in between
+    void to_rle(const std::string&) const;
+    void initialize_from_rle(const std::string&);
+
     void print() const {
         state.print();
     }
@@ -254,6 +660,10 @@ public:
         return state.size();
     }
 
+    const uint64_t* row_data(size_t row) const {
+        return state.row_data(row);
+    }
+
 
     // Some getter functions
     size_t get_rows() const { return rows; }
@@ -263,12 +673,13 @@ public:
     // Some subgrid utilities
     GameOfLife subgame(int start_row, int start_col, int end_row, int end_col) const {
         GameOfLife sub(MOD(end_row - start_row, rows), MOD(end_col - start_col, cols));
-        sub.state = state.subgrid(start_row, start_col, end_row, end_col);
+        sub.state = state.subgrid(start_row, start_col, end_row, end_col); // all tiles of a new game are marked as changed
         return sub;
     }
 
     void set_subgame(int start_row, int start_col, const Grid& subgrid) {
         state.set_subgrid(start_row, start_col, subgrid);
+        tiles.mark_all();
     }
 
     std::vector<unsigned char> get_row(int row) const {
@@ -281,65 +692,86 @@ public:
 
     void set_row(int row, const unsigned char* row_vec) {
         state.set_row(row, row_vec);
+        tiles.mark_row(wrap_index(row, rows));
     }
 
     void set_col(int col, const unsigned char* col_vec) {
         state.set_col(col, col_vec);
+        tiles.mark_col(wrap_index(col, cols));
+    }
+
+    // Storage of the current generation, e.g. for receiving ghost cells in place. Rows and columns that
+    // are changed through it have to be marked, so that the tick does not skip them.
+    uint64_t* row_data(size_t row) {
+        return state.row_data(row);
+    }
+
+    void mark_rows(size_t row_begin, size_t row_end) {
+        for (size_t row = row_begin; row < row_end; row++) tiles.mark_row(row);
+    }
+
+    void mark_cols(size_t col_begin, size_t col_end) {
+        for (size_t col = col_begin; col < col_end; col++) tiles.mark_col(col);
     }
 };
 
 
 // converting to and initializing from pgm
 void GameOfLife::initialize_from_pgm(const std::string& filename) {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file.is_open()) {
-        throw std::ios_base::failure("Failed to open file");
-    }
-
-    std::string magic_number;
-    file >> magic_number;
+    MappedFile file(filename);
 
-    if (magic_number != "P5") {
+    if (file.size < 2 || file.data[0] != 'P' || file.data[1] != '5') {
         throw std::invalid_argument("File is not in PGM P5 format");
     }
 
-    // Skip comments
-    file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-    while (file.peek() == '#') {
-        file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-    }
-
-    // Read dimensions and maximum gray value
-    file >> cols >> rows;
-    int max_val;
-    file >> max_val;
-    file.ignore(1); // Skip single whitespace character after max_val
+    // Parse dimensions and maximum gray value in place, into locals until the file is validated
+    size_t pos = 2;
+    const size_t new_cols = pnm_header_field(file, pos);
+    const size_t new_rows = pnm_header_field(file, pos);
+    size_t max_val = pnm_header_field(file, pos);
+    pos++; // Skip single whitespace character after max_val
 
     if (max_val != 1) {
         throw std::invalid_argument("Invalid max_val, only binary PGM (max_val = 1) is supported");
     }
+    if (pos > file.size || (new_cols && new_rows > (file.size - pos) / new_cols)) {
+        throw std::ios_base::failure("Unexpected end of file while reading pixel data");
+    }
 
     // Resize the grid to match the dimensions
-    state = Grid(rows, cols);
-    next_state = Grid(rows, cols);
-    element_count = rows * cols;
+    _resize(new_rows, new_cols);
+
+    // Pack the pixels straight from the mapping into the grid
+    for (size_t i = 0; i < rows; ++i) {
+        pack_bytes(state.row_data(i), 0, file.data + pos + i * cols, cols);
+    }
+}
 
-    // Read pixel data
-    std::vector<unsigned char> data(rows * cols);
-    file.read(reinterpret_cast<char*>(data.data()), rows * cols);
+void GameOfLife::initialize_from_pbm(const std::string& filename) {
+    MappedFile file(filename);
 
-    if (file.gcount() != static_cast<std::streamsize>(rows * cols)) {
+    if (file.size < 2 || file.data[0] != 'P' || file.data[1] != '4') {
+        throw std::invalid_argument("File is not in PBM P4 format");
+    }
+
+    // Parse dimensions in place, there is no maximum value in a bitmap. The board keeps its size
+    // until the file is known to be complete, _resize sets the new one.
+    size_t pos = 2;
+    const size_t new_cols = pnm_header_field(file, pos);
+    const size_t new_rows = pnm_header_field(file, pos);
+    pos++; // Skip single whitespace character after the rows
+
+    const size_t row_bytes = new_cols / 8 + (new_cols % 8 != 0);
+    if (pos > file.size || (row_bytes && new_rows > (file.size - pos) / row_bytes)) {
         throw std::ios_base::failure("Unexpected end of file while reading pixel data");
     }
 
-    // Populate the grid
+    _resize(new_rows, new_cols);
+
+    // Convert the rows straight from the mapping, reversing the bits of every byte
     for (size_t i = 0; i < rows; ++i) {
-        for (size_t j = 0; j < cols; ++j) {
-            state.set(i, j, data[i * cols + j] != 0);
-        }
+        pbm_to_bits(state.row_data(i), file.data + pos + i * row_bytes, cols);
     }
-
-    file.close();
 }
 
 void GameOfLife::to_pgm(const std::string& filename) const {
@@ -353,12 +785,166 @@ void GameOfLife::to_pgm(const std::string& filename) const {
     file << cols << " " << rows << "\n";
     file << "1\n";
 
-    // Write pixel data
+    // Write pixel data, a row at a time
+    std::vector<unsigned char> line(cols);
     for (size_t i = 0; i < rows; i++) {
-        for (size_t j = 0; j < cols; j++) {
-            unsigned char pixel = state.get(i, j) ? 1 : 0;
-            file.write(reinterpret_cast<char*>(&pixel), 1);
+        expand_bits(line.data(), state.row_data(i), 0, cols);
+        file.write(reinterpret_cast<const char*>(line.data()), cols);
+    }
+
+    file.close();
+}
+
+void GameOfLife::initialize_from_rle(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::ios_base::failure("Failed to open file");
+    }
+
+    // Skip comments, up to the header line
+    std::string line;
+    while (std::getline(file, line) && (line.empty() || line[0] == '#')) {}
+
+    // Parse the header, "x = 3, y = 2" with an optional rule
+    size_t header_rows = 0, header_cols = 0;
+    bool has_x = false, has_y = false;
+    std::istringstream header(line);
+    std::string field;
+    while (std::getline(header, field, ',')) {
+        const size_t equals = field.find('=');
+        if (equals == std::string::npos) {
+            throw std::invalid_argument("Invalid RLE header");
+        }
+        std::string key = field.substr(0, equals), value = field.substr(equals + 1);
+        key.erase(std::remove_if(key.begin(), key.end(), ::isspace), key.end());
+        value.erase(std::remove_if(value.begin(), value.end(), ::isspace), value.end());
+        if (key == "x") {
+            header_cols = std::stoul(value);
+            has_x = true;
+        } else if (key == "y") {
+            header_rows = std::stoul(value);
+            has_y = true;
+        } else if (key == "rule") {
+            std::transform(value.begin(), value.end(), value.begin(), ::toupper);
+            if (value != "B3/S23" && value != "23/3") {
+                throw std::invalid_argument("Only the rule B3/S23 is supported");
+            }
+        }
+    }
+    if (!has_x || !has_y) {
+        throw std::invalid_argument("Invalid RLE header, x and y are required");
+    }
+
+    // Stream the runs into a grid of the header size: <count><tag>, where b is dead, o is alive, $ ends
+    // a row and ! ends the pattern. Living runs are set a word at a time. The board only takes the
+    // pattern once all of it is read.
+    Grid pattern(header_rows, header_cols);
+    const size_t max_run = std::max(header_rows, header_cols);
+    size_t row = 0, col = 0, count = 0;
+    for (int c = file.get(); c != EOF && c != '!'; c = file.get()) {
+        if (c >= '0' && c <= '9') {
+            count = count * 10 + (c - '0');
+            if (count > max_run) {
+                throw std::invalid_argument("RLE run longer than the pattern");
+            }
+            continue;
+        }
+        if (isspace(c)) continue;
+        const size_t run = count ? count : 1;
+        count = 0;
+        if (c == '$') {
+            row += run;
+            col = 0;
+        } else if (c == 'b' || c == 'o') {
+            if (row >= header_rows || col + run > header_cols) {
+                throw std::invalid_argument("RLE pattern larger than its header");
+            }
+            if (c == 'o') {
+                for (size_t bit = col; bit < col + run;) {
+                    const size_t n = std::min<size_t>(col + run - bit, 64 - (bit & 63));
+                    const uint64_t mask = (n == 64) ? ~uint64_t(0) : (uint64_t(1) << n) - 1;
+                    pattern.row_data(row)[bit >> 6] |= mask << (bit & 63);
+                    bit += n;
+                }
+            }
+            col += run;
+        } else {
+            throw std::invalid_argument("Unsupported RLE tag, only b, o, $ and ! are supported");
+        }
+    }
+
+    _resize(header_rows, header_cols);
+    std::swap(state, pattern);
+    file.close();
+}
+
+void GameOfLife::to_rle(const std::string& filename) const {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::ios_base::failure("Failed to open file");
+    }
+
+    file << "x = " << cols << ", y = " << rows << ", rule = B3/S23\n";
+
+    // Lines of at most 70 characters, as other programs expect
+    std::string line;
+    auto emit = [&](size_t run, char tag) {
+        std::string item = (run > 1 ? std::to_string(run) : std::string()) + tag;
+        if (line.size() + item.size() > 70) {
+            file << line << "\n";
+            line.clear();
         }
+        line += item;
+    };
+
+    // The runs of a row are found a word at a time with ctz. Trailing dead cells and empty rows at
+    // the end are left out, and empty rows in between become a count before $.
+    size_t current_row = 0;
+    for (size_t i = 0; i < rows; i++) {
+        const uint64_t* row = state.row_data(i);
+        // first bit at or after `bit` that is `alive`, or cols
+        auto next = [&](size_t bit, bool alive) {
+            while (bit < cols) {
+                const uint64_t word = (alive ? row[bit >> 6] : ~row[bit >> 6]) >> (bit & 63);
+                if (word) return std::min(cols, bit + __builtin_ctzll(word));
+                bit = (bit | 63) + 1;
+            }
+            return cols;
+        };
+
+        size_t begin = next(0, true);
+        if (begin == cols) continue;
+        if (i > current_row) emit(i - current_row, '$');
+        current_row = i;
+
+        size_t end = 0;
+        while (begin < cols) {
+            if (begin > end) emit(begin - end, 'b');
+            end = next(begin, false);
+            emit(end - begin, 'o');
+            begin = next(end, true);
+        }
+    }
+    emit(1, '!');
+    file << line << "\n";
+    file.close();
+}
+
+void GameOfLife::to_pbm(const std::string& filename) const {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::ios_base::failure("Failed to open file");
+    }
+
+    // Write PBM header
+    file << "P4\n";
+    file << cols << " " << rows << "\n";
+
+    // Write pixel data, a row at a time
+    std::vector<unsigned char> line((cols + 7) >> 3);
+    for (size_t i = 0; i < rows; i++) {
+        bits_to_pbm(line.data(), state.row_data(i), cols);
+        file.write(reinterpret_cast<const char*>(line.data()), line.size());
     }
 
     file.close();
@@ -6,6 +6,58 @@
 #include <sstream>
 #include <mpi.h>
 #include <cstring>
+#include <cstdlib>
+
+// Initializes MPI for ranks that tick with a thread team. The compute threads never call MPI, so the
+// main thread alone needs it (MPI_THREAD_FUNNELED), unless the halo is exchanged by a communication
+// thread while the main thread computes (MPI_THREAD_SERIALIZED).
+inline void init_mpi_threads(int* argc, char*** argv, bool comm_thread = false) {
+    const int required = comm_thread ? MPI_THREAD_SERIALIZED : MPI_THREAD_FUNNELED;
+    int provided;
+    MPI_Init_thread(argc, argv, required, &provided);
+    if (provided < required) {
+        throw std::runtime_error("The MPI library does not support the required level of threading");
+    }
+}
+
+// Splits `ranks` processes into a proc_rows x proc_cols grid over a grid_rows x grid_cols board. A
+// dimension of 0 is chosen automatically: among the factorizations, the one whose largest subgrid has
+// the smallest halo perimeter, so a tall board is cut into row bands and a wide one into column bands.
+// On a tie, fewer process columns win, since rows are exchanged in place and columns are strided.
+inline void choose_proc_grid(size_t ranks, size_t grid_rows, size_t grid_cols, size_t& proc_rows, size_t& proc_cols) {
+    if ((proc_rows && ranks % proc_rows) || (proc_cols && ranks % proc_cols) ||
+        (proc_rows && proc_cols && proc_rows * proc_cols != ranks)) {
+        throw std::invalid_argument("The process grid does not match the number of processes");
+    }
+    if (proc_rows || proc_cols) {
+        if (!proc_cols) proc_cols = ranks / proc_rows;
+        if (!proc_rows) proc_rows = ranks / proc_cols;
+        if (proc_rows > grid_rows || proc_cols > grid_cols) {
+            throw std::invalid_argument("The board is too small for the process grid");
+        }
+        return;
+    }
+
+    size_t best_cost = SIZE_MAX;
+    for (size_t rows = 1; rows <= ranks; rows++) {
+        if (ranks % rows || rows > grid_rows || ranks / rows > grid_cols) continue;
+        const size_t cols = ranks / rows;
+        const size_t cost = (grid_rows + rows - 1) / rows + (grid_cols + cols - 1) / cols;
+        if (cost < best_cost || (cost == best_cost && cols < proc_cols)) {
+            best_cost = cost;
+            proc_rows = rows;
+            proc_cols = cols;
+        }
+    }
+    if (best_cost == SIZE_MAX) {
+        throw std::invalid_argument("The board is too small for the number of processes");
+    }
+}
+
+// How the halo moves between the ranks: persistent sends and receives, puts into RMA windows of the
+// neighbors with post-start-complete-wait synchronization, or, between ranks on the same node, reads
+// from a shared memory segment, with sends and receives to the other nodes
+enum class HaloBackend { SendRecv, RMA, Shared };
 
 class MPIProcess {
     size_t proc_rows, proc_cols;        // Number of rows and columns in the MPI grid
@@ -13,63 +65,546 @@ class MPIProcess {
     int rank;                           // MPI rank of the process
     int root;                           // Root process rank
     size_t grid_rows, grid_cols;        // Dimensions of the global grid
-    size_t subgrid_rows, subgrid_cols;  // Dimensions of this process's subgrid (IMPORTANT: Note that each dimension is two less than the actual dimensions of subgame because subgame has a border of 1 cell at each side)
+    size_t subgrid_rows, subgrid_cols;  // Dimensions of this process's subgrid (IMPORTANT: Note that each dimension is 2 * halo less than the actual dimensions of subgame because subgame has a border of halo cells at each side)
     int starting_row, starting_col;     // Starting coordinates of the subgrid
     int ending_row, ending_col;         // Ending coordinates of the subgrid
 
     GameOfLife subgame;
 
-    size_t neighbor_ranks[4];           // Ranks of the neighboring processes: N, S, E, W
+    MPI_Comm cart_comm = MPI_COMM_NULL; // Periodic Cartesian topology of the process grid
+    int neighbor_ranks[8];              // Ranks of the neighboring processes, by direction
+
+    size_t halo = 1;                    // Width of the ghost border
+    size_t phase = 0;                   // Generations computed by step() since the last exchange
+
+    // The directions of the neighbors. A message is tagged with the direction it travels in.
+    enum { NORTH, SOUTH, EAST, WEST, NORTH_EAST, SOUTH_WEST, NORTH_WEST, SOUTH_EAST };
+    static int _opposite(int direction) { return direction ^ 1; }
+
+    // The halo is exchanged with all eight neighbors at once. The rows are sent and received in place.
+    // The columns and the corners are sent in place as the words that hold them, with strided datatypes,
+    // and received into buffers, one block of words per row, to be merged into the ghost cells.
+    uint64_t* recv_block = nullptr;     // one allocation for all the receive buffers, laid out by _recv_layout()
+    uint64_t* recv_buffers[8] = {};     // by the direction of the sender, none for north and south
+    MPI_Datatype left_col_type = MPI_DATATYPE_NULL, right_col_type = MPI_DATATYPE_NULL;
+    MPI_Datatype left_corner_type = MPI_DATATYPE_NULL, right_corner_type = MPI_DATATYPE_NULL;
+    size_t west_block = 0, west_offset = 0; // words per row sent by the western neighbors, and the bit of their first column
+    size_t east_block = 0, east_offset = 0;
+
+    // Persistent requests for each of the two grids of the subgame, which take turns holding the
+    // current generation: a receive and a send per neighbor, but for the neighbors on the same node
+    // with the shared backend
+    struct HaloRequests {
+        const void* grid = nullptr;
+        MPI_Request all[16];
+        int count = 0;
+    } halo_requests[2];
+    HaloRequests* active_requests = nullptr;
+
+    std::unique_ptr<ThreadTeam> comm_team; // main thread computing and communication thread, if enabled
+
+    // The RMA backend exposes the ghost rows in place, in a window for each of the two grids of the
+    // subgame, and the receive buffers in one more window. The neighbors put into them directly.
+    HaloBackend backend = HaloBackend::SendRecv;
+    MPI_Group neighbor_group = MPI_GROUP_NULL;
+    MPI_Win buffer_window = MPI_WIN_NULL;
+    struct GridWindow {
+        const void* grid = nullptr;
+        MPI_Win window = MPI_WIN_NULL;
+    } grid_windows[2];
+    GridWindow* active_window = nullptr;
+
+    // The shared backend. Every rank writes its border into its segment of a window shared by the
+    // ranks of the node, as it would send it, and the neighbors on the node read it from there after
+    // a barrier. The segment holds two copies that alternate between exchanges, so that one barrier
+    // per exchange is enough: a rank rewrites a copy only after its neighbors have read it.
+    MPI_Comm node_comm = MPI_COMM_NULL;
+    int node_ranks[8];                  // ranks of the neighbors in node_comm, MPI_UNDEFINED if on another node
+    MPI_Win shared_window = MPI_WIN_NULL;
+    uint64_t* outbox = nullptr;         // this rank's segment
+    size_t outbox_words = 0, outbox_offsets[8];
+    uint64_t* neighbor_outboxes[8] = {}; // the section of each neighbor's segment addressed to this rank
+    size_t neighbor_outbox_words[8] = {};
+    size_t shared_parity = 0;
+    MPI_Request barrier_request = MPI_REQUEST_NULL;
+
+    // The first row of every row of processes and the first column of every column of processes, with
+    // the size of the board at the end. They start out even and follow the load after rebalance().
+    std::vector<size_t> row_bounds, col_bounds;
+    size_t balance_interval = 0;        // generations between two calls of rebalance() by step(), 0 for never
+    size_t generation = 0;
+
+    // First and last (exclusive) index of block `index` when `total` cells are split into `count` blocks.
+    // The first total % count blocks get one cell more, so no rank has more than one row or column
+    // more than another, where the last rank used to take the whole remainder.
+    static void _block(size_t index, size_t count, size_t total, size_t& begin, size_t& end) {
+        const size_t size = total / count, remainder = total % count;
+        begin = index * size + std::min(index, remainder);
+        end = begin + size + (index < remainder);
+    }
+
+    static std::vector<size_t> _even_bounds(size_t count, size_t total) {
+        std::vector<size_t> bounds(count + 1);
+        for (size_t i = 0; i < count; i++) {
+            size_t end;
+            _block(i, count, total, bounds[i], end);
+        }
+        bounds[count] = total;
+        return bounds;
+    }
+
+    // Bounds that give every block about the same share of `load`, and at least `minimum` cells. The
+    // prefix sums are cut where they cross multiples of the total divided by the number of blocks.
+    static std::vector<size_t> _balanced_bounds(const std::vector<uint64_t>& load, size_t count, size_t minimum) {
+        const size_t total = load.size();
+        uint64_t sum = 0;
+        for (uint64_t l : load) sum += l;
+        std::vector<size_t> bounds(count + 1, 0);
+        bounds[count] = total;
+        uint64_t prefix = 0;
+        size_t i = 0;
+        for (size_t b = 1; b < count; b++) {
+            const uint64_t target = sum * b / count;
+            while (i < total && prefix + load[i] / 2 < target) prefix += load[i++]; // cut at the middle of a cell
+            bounds[b] = std::min(std::max(i, bounds[b - 1] + minimum), total - (count - b) * minimum);
+        }
+        return bounds;
+    }
+
+    static size_t _smallest_block(const std::vector<size_t>& bounds) {
+        size_t smallest = SIZE_MAX;
+        for (size_t i = 0; i + 1 < bounds.size(); i++) smallest = std::min(smallest, bounds[i + 1] - bounds[i]);
+        return smallest;
+    }
+
+    // Finds the rows and columns of this rank's subgrid
+    void _decompose() {
+        starting_row = row_bounds[proc_row];
+        ending_row = row_bounds[proc_row + 1];
+        starting_col = col_bounds[proc_col];
+        ending_col = col_bounds[proc_col + 1];
+        subgrid_rows = ending_row - starting_row;
+        subgrid_cols = ending_col - starting_col;
+    }
+
+    // Row and column offset of the neighbor in a direction
+    static const int* _offset(int direction) {
+        static const int offsets[8][2] = {{-1, 0}, {1, 0}, {0, 1}, {0, -1}, {-1, 1}, {1, -1}, {-1, -1}, {1, 1}};
+        return offsets[direction];
+    }
+
+    // Creates the Cartesian communicator and finds the ranks of the neighbors. The ranks are not
+    // reordered, so that rank r keeps the coordinates rank_to_coords(r).
+    void _create_topology() {
+        int dims[2] = {int(proc_rows), int(proc_cols)}, periods[2] = {1, 1};
+        MPI_Cart_create(MPI_COMM_WORLD, 2, dims, periods, 0, &cart_comm);
+        for (int direction = 0; direction < 8; direction++) {
+            int coords[2] = {proc_row + _offset(direction)[0], proc_col + _offset(direction)[1]}; // wrap around, the grid is periodic
+            MPI_Cart_rank(cart_comm, coords, &neighbor_ranks[direction]);
+        }
+
+        // the distinct neighbors, which synchronize with each other in the RMA epochs
+        std::vector<int> neighbors(neighbor_ranks, neighbor_ranks + 8);
+        std::sort(neighbors.begin(), neighbors.end());
+        neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+        MPI_Group cart_group;
+        MPI_Comm_group(cart_comm, &cart_group);
+        MPI_Group_incl(cart_group, neighbors.size(), neighbors.data(), &neighbor_group);
+
+        // the neighbors that share memory with this rank
+        MPI_Comm_split_type(cart_comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node_comm);
+        MPI_Group node_group;
+        MPI_Comm_group(node_comm, &node_group);
+        MPI_Group_translate_ranks(cart_group, 8, neighbor_ranks, node_group, node_ranks);
+        MPI_Group_free(&node_group);
+        MPI_Group_free(&cart_group);
+    }
+
+    bool _on_node(int direction) const {
+        return backend == HaloBackend::Shared && node_ranks[direction] != MPI_UNDEFINED;
+    }
+
+    // Offsets of the border sent in each direction, by the rank at (row, col) of the process grid, in
+    // its shared segment, in words. Returns the size of one copy of the border.
+    size_t _send_layout(int row, int col, size_t offsets[8]) const {
+        row = MOD(row, proc_rows);
+        col = MOD(col, proc_cols);
+        const size_t rows = row_bounds[row + 1] - row_bounds[row];
+        const size_t cols = col_bounds[col + 1] - col_bounds[col] + 2 * halo;
+        size_t offset = 0;
+        for (int direction = 0; direction < 8; direction++) {
+            offsets[direction] = offset;
+            const size_t block = (_offset(direction)[1] > 0) ? _right_block(cols) : _left_block();
+            if (direction == NORTH || direction == SOUTH) offset += halo * Grid::words_per_row(cols);
+            else if (direction == EAST || direction == WEST) offset += rows * block;
+            else offset += halo * block;
+        }
+        return offset;
+    }
+
+    // Words per row that hold the columns [halo, 2 * halo) and [cols - 2 * halo, cols - halo) of a subgame with `cols` columns
+    size_t _left_block() const { return ((2 * halo - 1) >> 6) - (halo >> 6) + 1; }
+    size_t _right_block(size_t cols) const { return ((cols - halo - 1) >> 6) - ((cols - 2 * halo) >> 6) + 1; }
+
+    // Offsets of the receive buffers, by direction, in the receive block of the rank at (row, col) of
+    // the process grid, in words. Returns the size of the block. The RMA backend needs the layout of
+    // the neighbors to put into their buffers.
+    size_t _recv_layout(int row, int col, size_t offsets[8]) const {
+        row = MOD(row, proc_rows);
+        col = MOD(col, proc_cols);
+        const size_t west = MOD(col - 1, proc_cols);
+        const size_t western_block = _right_block(col_bounds[west + 1] - col_bounds[west] + 2 * halo);
+        const size_t eastern_block = _left_block();
+        const size_t col_rows = row_bounds[row + 1] - row_bounds[row];
+        size_t offset = 0;
+        for (int direction : {NORTH_WEST, SOUTH_WEST, NORTH_EAST, SOUTH_EAST, WEST, EAST}) {
+            offsets[direction] = offset;
+            const bool corner = direction != WEST && direction != EAST;
+            const bool western = direction == WEST || direction == NORTH_WEST || direction == SOUTH_WEST;
+            offset += (corner ? halo : col_rows) * (western ? western_block : eastern_block);
+        }
+        offsets[NORTH] = offsets[SOUTH] = 0; // received in place
+        return offset;
+    }
 
-    unsigned char* top_row_recv = nullptr;
-    unsigned char* bottom_row_recv = nullptr;
-    unsigned char* left_col_recv = nullptr;
-    unsigned char* right_col_recv = nullptr;
+    void _free_requests(HaloRequests& requests) {
+        if (requests.grid) {
+            for (int i = 0; i < requests.count; i++) MPI_Request_free(&requests.all[i]);
+        }
+        requests.grid = nullptr;
+        requests.count = 0;
+    }
+
+    void _free_buffers() {
+        int finalized;
+        MPI_Finalized(&finalized);
+        if (!finalized) {
+            for (auto& requests : halo_requests) _free_requests(requests);
+            for (MPI_Datatype* type : {&left_col_type, &right_col_type, &left_corner_type, &right_corner_type}) {
+                if (*type != MPI_DATATYPE_NULL) MPI_Type_free(type);
+            }
+            for (auto& window : grid_windows) _free_window(window);
+            if (buffer_window != MPI_WIN_NULL) MPI_Win_free(&buffer_window);
+            if (shared_window != MPI_WIN_NULL) {
+                MPI_Win_unlock_all(shared_window);
+                MPI_Win_free(&shared_window);
+            }
+        }
+        outbox = nullptr;
+        for (auto& neighbor_outbox : neighbor_outboxes) neighbor_outbox = nullptr;
+        shared_parity = 0;
+        active_requests = nullptr;
+        active_window = nullptr;
+        free(recv_block);
+        recv_block = nullptr;
+        for (auto& buffer : recv_buffers) buffer = nullptr;
+    }
+
+    void _free_window(GridWindow& window) {
+        if (window.window != MPI_WIN_NULL) MPI_Win_free(&window.window);
+        window.grid = nullptr;
+    }
+
+    // Sets up the datatypes and receive buffers for the current subgame and halo. The requests are
+    // created by _requests() once the grids are known.
+    void _allocate_buffers() {
+        _free_buffers();
+        const size_t rows = subgame.get_rows(), cols = subgame.get_cols(), words = Grid::words_per_row(cols);
+
+        // The words holding the columns [halo, 2 * halo) and [cols - 2 * halo, cols - halo), in the
+        // rows of the subgrid for the east and west neighbors, and in `halo` rows for the corners
+        const size_t left_block = _left_block();
+        const size_t right_block = _right_block(cols);
+        MPI_Type_vector(rows - 2 * halo, left_block, words, MPI_UINT64_T, &left_col_type);
+        MPI_Type_vector(rows - 2 * halo, right_block, words, MPI_UINT64_T, &right_col_type);
+        MPI_Type_vector(halo, left_block, words, MPI_UINT64_T, &left_corner_type);
+        MPI_Type_vector(halo, right_block, words, MPI_UINT64_T, &right_corner_type);
+        for (MPI_Datatype* type : {&left_col_type, &right_col_type, &left_corner_type, &right_corner_type}) {
+            MPI_Type_commit(type);
+        }
+
+        // The eastern neighbors send their left blocks, the western neighbors their right blocks
+        const size_t west = MOD(proc_col - 1, proc_cols);
+        const size_t west_cols = col_bounds[west + 1] - col_bounds[west] + 2 * halo;
+        west_block = _right_block(west_cols);
+        west_offset = (west_cols - 2 * halo) & 63;
+        east_block = left_block;
+        east_offset = halo & 63;
+
+        size_t offsets[8];
+        const size_t recv_words = _recv_layout(proc_row, proc_col, offsets);
+        recv_block = static_cast<uint64_t*>(aligned_alloc(64, ((recv_words * sizeof(uint64_t)) | 63) + 1));
+        if (!recv_block) throw std::bad_alloc();
+        for (int direction : {NORTH_WEST, SOUTH_WEST, NORTH_EAST, SOUTH_EAST, WEST, EAST}) {
+            recv_buffers[direction] = recv_block + offsets[direction];
+        }
+        if (backend == HaloBackend::RMA) {
+            MPI_Win_create(recv_block, recv_words * sizeof(uint64_t), sizeof(uint64_t), MPI_INFO_NULL, cart_comm, &buffer_window);
+        }
+
+        if (backend == HaloBackend::Shared) {
+            outbox_words = _send_layout(proc_row, proc_col, outbox_offsets);
+            MPI_Win_allocate_shared(2 * outbox_words * sizeof(uint64_t), sizeof(uint64_t), MPI_INFO_NULL, node_comm, &outbox, &shared_window);
+            MPI_Win_lock_all(MPI_MODE_NOCHECK, shared_window); // for MPI_Win_sync
+            for (int from = 0; from < 8; from++) {
+                if (!_on_node(from)) continue;
+                MPI_Aint size;
+                int unit;
+                uint64_t* segment;
+                MPI_Win_shared_query(shared_window, node_ranks[from], &size, &unit, &segment);
+                size_t offsets[8];
+                neighbor_outbox_words[from] = _send_layout(proc_row + _offset(from)[0], proc_col + _offset(from)[1], offsets);
+                neighbor_outboxes[from] = segment + offsets[_opposite(from)];
+            }
+        }
+    }
+
+    // The window of the grid that currently holds the subgame, created the first time it is seen.
+    // Every rank creates its windows at the same generations, so that window i holds the current
+    // generation on all ranks at once.
+    GridWindow& _grid_window() {
+        const void* grid = subgame.data();
+        for (auto& window : grid_windows) {
+            if (window.grid == grid) return window;
+        }
+        GridWindow& window = grid_windows[grid_windows[0].grid != nullptr];
+        _free_window(window);
+        window.grid = grid;
+        MPI_Win_create(subgame.row_data(0), subgame.size(), sizeof(uint64_t), MPI_INFO_NULL, cart_comm, &window.window);
+        return window;
+    }
+
+    // Puts the outermost `halo` cells of the subgrid into the ghost rows and receive buffers of the
+    // neighbors, in an access epoch of the neighbors, which expose their windows at the same time
+    void _post_halo_rma() {
+        active_window = &_grid_window();
+        MPI_Win_post(neighbor_group, 0, active_window->window);
+        MPI_Win_post(neighbor_group, 0, buffer_window);
+        MPI_Win_start(neighbor_group, 0, active_window->window);
+        MPI_Win_start(neighbor_group, 0, buffer_window);
+
+        const size_t rows = subgame.get_rows(), cols = subgame.get_cols(), words = Grid::words_per_row(cols);
+        const size_t col_rows = rows - 2 * halo;
+        uint64_t* top = subgame.row_data(halo);
+        uint64_t* bottom = subgame.row_data(rows - 2 * halo);
+        const size_t left = halo >> 6, right = (cols - 2 * halo) >> 6;
+
+        // the rows go to the ghost rows of the neighbors, which are in the same column of processes
+        const size_t north_rows = row_bounds[MOD(proc_row - 1, proc_rows) + 1] - row_bounds[MOD(proc_row - 1, proc_rows)] + 2 * halo;
+        MPI_Put(top, halo * words, MPI_UINT64_T, neighbor_ranks[NORTH], (north_rows - halo) * words, halo * words, MPI_UINT64_T, active_window->window);
+        MPI_Put(bottom, halo * words, MPI_UINT64_T, neighbor_ranks[SOUTH], 0, halo * words, MPI_UINT64_T, active_window->window);
+
+        // the columns and corners to the buffers of the neighbor for the opposite direction
+        auto put = [&](const uint64_t* origin, MPI_Datatype type, int to, size_t count) {
+            size_t offsets[8];
+            _recv_layout(proc_row + _offset(to)[0], proc_col + _offset(to)[1], offsets);
+            MPI_Put(origin, 1, type, neighbor_ranks[to], offsets[_opposite(to)], count, MPI_UINT64_T, buffer_window);
+        };
+        const size_t left_block = _left_block(), right_block = _right_block(cols);
+        put(top + right, right_col_type, EAST, col_rows * right_block);
+        put(top + left, left_col_type, WEST, col_rows * left_block);
+        put(top + right, right_corner_type, NORTH_EAST, halo * right_block);
+        put(top + left, left_corner_type, NORTH_WEST, halo * left_block);
+        put(bottom + right, right_corner_type, SOUTH_EAST, halo * right_block);
+        put(bottom + left, left_corner_type, SOUTH_WEST, halo * left_block);
+    }
+
+    void _wait_halo_rma() {
+        MPI_Win_complete(active_window->window);
+        MPI_Win_complete(buffer_window);
+        MPI_Win_wait(active_window->window);
+        MPI_Win_wait(buffer_window);
+    }
+
+    // The requests for the grid that currently holds the subgame, created the first time it is seen
+    HaloRequests& _requests() {
+        const void* grid = subgame.data();
+        for (auto& requests : halo_requests) {
+            if (requests.grid == grid) return requests;
+        }
+        HaloRequests& requests = halo_requests[halo_requests[0].grid != nullptr];
+        _free_requests(requests);
+        requests.grid = grid;
+
+        const size_t rows = subgame.get_rows(), cols = subgame.get_cols(), words = Grid::words_per_row(cols);
+        const int row_count = halo * words, col_count = rows - 2 * halo;
+
+        // Receive from the neighbor in each direction, the message travels the opposite way
+        auto recv_init = [&](void* buffer, int count, int from) {
+            if (_on_node(from)) return;
+            MPI_Recv_init(buffer, count, MPI_UINT64_T, neighbor_ranks[from], _opposite(from), cart_comm, &requests.all[requests.count++]);
+        };
+        recv_init(subgame.row_data(0), row_count, NORTH);
+        recv_init(subgame.row_data(rows - halo), row_count, SOUTH);
+        recv_init(recv_buffers[EAST], col_count * east_block, EAST);
+        recv_init(recv_buffers[WEST], col_count * west_block, WEST);
+        recv_init(recv_buffers[NORTH_EAST], halo * east_block, NORTH_EAST);
+        recv_init(recv_buffers[NORTH_WEST], halo * west_block, NORTH_WEST);
+        recv_init(recv_buffers[SOUTH_EAST], halo * east_block, SOUTH_EAST);
+        recv_init(recv_buffers[SOUTH_WEST], halo * west_block, SOUTH_WEST);
+
+        uint64_t* top = subgame.row_data(halo);
+        uint64_t* bottom = subgame.row_data(rows - 2 * halo);
+        const size_t left = halo >> 6, right = (cols - 2 * halo) >> 6;
+        auto send_init = [&](const void* buffer, int count, MPI_Datatype type, int to) {
+            if (_on_node(to)) return;
+            MPI_Send_init(buffer, count, type, neighbor_ranks[to], to, cart_comm, &requests.all[requests.count++]);
+        };
+        send_init(top, row_count, MPI_UINT64_T, NORTH);
+        send_init(bottom, row_count, MPI_UINT64_T, SOUTH);
+        send_init(top + right, 1, right_col_type, EAST);
+        send_init(top + left, 1, left_col_type, WEST);
+        send_init(top + right, 1, right_corner_type, NORTH_EAST);
+        send_init(top + left, 1, left_corner_type, NORTH_WEST);
+        send_init(bottom + right, 1, right_corner_type, SOUTH_EAST);
+        send_init(bottom + left, 1, left_corner_type, SOUTH_WEST);
+        return requests;
+    }
+
+    // Starts sending the outermost `halo` cells of the subgrid to the eight neighbors, and receiving the ghost cells
+    void _post_halo() {
+        if (backend == HaloBackend::RMA) {
+            _post_halo_rma();
+            return;
+        }
+        if (backend == HaloBackend::Shared) _post_halo_shared();
+        active_requests = &_requests();
+        MPI_Startall(active_requests->count, active_requests->all);
+    }
+
+    void _wait_halo() {
+        if (backend == HaloBackend::RMA) {
+            _wait_halo_rma();
+            return;
+        }
+        MPI_Waitall(active_requests->count, active_requests->all, MPI_STATUSES_IGNORE);
+        if (backend == HaloBackend::Shared) _wait_halo_shared();
+    }
+
+    // Writes the border for the neighbors on the node into the shared segment, and enters the barrier
+    // after which they can read it
+    void _post_halo_shared() {
+        const size_t rows = subgame.get_rows(), cols = subgame.get_cols(), words = Grid::words_per_row(cols);
+        const size_t left = halo >> 6, right = (cols - 2 * halo) >> 6;
+        const size_t left_block = _left_block(), right_block = _right_block(cols);
+        uint64_t* border = outbox + shared_parity * outbox_words;
+        auto pack = [&](int to, size_t row_begin, size_t row_end, size_t word, size_t block) {
+            if (!_on_node(to)) return;
+            uint64_t* packed = border + outbox_offsets[to];
+            for (size_t i = row_begin; i < row_end; i++, packed += block) {
+                memcpy(packed, subgame.row_data(i) + word, block * sizeof(uint64_t));
+            }
+        };
+        pack(NORTH, halo, 2 * halo, 0, words);
+        pack(SOUTH, rows - 2 * halo, rows - halo, 0, words);
+        pack(EAST, halo, rows - halo, right, right_block);
+        pack(WEST, halo, rows - halo, left, left_block);
+        pack(NORTH_EAST, halo, 2 * halo, right, right_block);
+        pack(NORTH_WEST, halo, 2 * halo, left, left_block);
+        pack(SOUTH_EAST, rows - 2 * halo, rows - halo, right, right_block);
+        pack(SOUTH_WEST, rows - 2 * halo, rows - halo, left, left_block);
+        MPI_Win_sync(shared_window);
+        MPI_Ibarrier(node_comm, &barrier_request);
+    }
+
+    // Reads the ghost rows from the segments of the neighbors on the node, and points the receive
+    // buffers of the columns and corners at them, for _apply_halo() to merge without a copy
+    void _wait_halo_shared() {
+        MPI_Wait(&barrier_request, MPI_STATUS_IGNORE);
+        MPI_Win_sync(shared_window);
+        const size_t rows = subgame.get_rows(), words = Grid::words_per_row(subgame.get_cols());
+        for (int from = 0; from < 8; from++) {
+            if (!_on_node(from)) continue;
+            uint64_t* border = neighbor_outboxes[from] + shared_parity * neighbor_outbox_words[from];
+            if (from == NORTH) memcpy(subgame.row_data(0), border, halo * words * sizeof(uint64_t));
+            else if (from == SOUTH) memcpy(subgame.row_data(rows - halo), border, halo * words * sizeof(uint64_t));
+            else recv_buffers[from] = border;
+        }
+        shared_parity ^= 1;
+    }
+
+    // Exchanges the halo without touching the cells the tick reads, so that the subgame can be computed
+    // at the same time: only the ghost rows are written
+    void _exchange_halo() {
+        _post_halo();
+        _wait_halo();
+    }
+
+    // Merges the received columns and corners into the ghost cells. The ghost rows were received in
+    // place, with the stale corners of the northern and southern neighbors, which are overwritten here.
+    void _apply_halo() {
+        const size_t rows = subgame.get_rows(), cols = subgame.get_cols();
+        subgame.mark_rows(0, halo);
+        subgame.mark_rows(rows - halo, rows);
+        for (size_t i = 0; i < rows; i++) {
+            const uint64_t* west;
+            const uint64_t* east;
+            if (i < halo) {
+                west = recv_buffers[NORTH_WEST] + i * west_block;
+                east = recv_buffers[NORTH_EAST] + i * east_block;
+            } else if (i >= rows - halo) {
+                west = recv_buffers[SOUTH_WEST] + (i - (rows - halo)) * west_block;
+                east = recv_buffers[SOUTH_EAST] + (i - (rows - halo)) * east_block;
+            } else {
+                west = recv_buffers[WEST] + (i - halo) * west_block;
+                east = recv_buffers[EAST] + (i - halo) * east_block;
+            }
+            uint64_t* row = subgame.row_data(i);
+            copy_bits(row, 0, west, west_offset, halo);
+            copy_bits(row, cols - halo, east, east_offset, halo);
+        }
+        subgame.mark_cols(0, halo);
+        subgame.mark_cols(cols - halo, cols);
+    }
+
+    // The rows and words of the subgame that do not depend on the ghost cells
+    void _interior(size_t& row_begin, size_t& row_end, size_t& word_begin, size_t& word_end) const {
+        row_begin = halo + 1;
+        row_end = std::max(subgame.get_rows(), 2 * halo + 2) - halo - 1;
+        word_begin = (halo + 64) >> 6;                       // the first word must not reach column halo - 1
+        word_end = (subgame.get_cols() - halo - 1) >> 6;     // the last word must not reach column cols - halo
+    }
 
 public:
+    // A proc_rows or proc_cols of 0 is chosen from the number of processes and the shape of the board
     MPIProcess(const std::string& filename, size_t proc_rows, size_t proc_cols, int root);
-    MPIProcess(const GameOfLife& game, size_t proc_rows, size_t proc_cols, int root)
-        : proc_rows(proc_rows), proc_cols(proc_cols), root(root), grid_rows(game.get_rows()), grid_cols(game.get_cols())
+    MPIProcess(const GameOfLife& game, size_t _proc_rows, size_t _proc_cols, int root)
+        : proc_rows(_proc_rows), proc_cols(_proc_cols), root(root), grid_rows(game.get_rows()), grid_cols(game.get_cols())
         {
         // Initialize MPI
         int size;
         MPI_Comm_size(MPI_COMM_WORLD, &size);
-        if (size != proc_rows * proc_cols) {
-            throw std::runtime_error("Number of processes must be equal to proc_rows * proc_cols");
-        }
+        choose_proc_grid(size, grid_rows, grid_cols, proc_rows, proc_cols);
 
         MPI_Comm_rank(MPI_COMM_WORLD, &rank);
         rank_to_coords(rank, proc_row, proc_col);
 
         // Calculate subgrid dimensions and positions
-        subgrid_rows = grid_rows / proc_rows; // only temporary
-        subgrid_cols = grid_cols / proc_cols; // same here
-        starting_row = proc_row * subgrid_rows;
-        starting_col = proc_col * subgrid_cols;
-        ending_row = (proc_row == proc_rows - 1) ? grid_rows : starting_row + subgrid_rows;
-        ending_col = (proc_col == proc_cols - 1) ? grid_cols : starting_col + subgrid_cols;
-        subgrid_rows = ending_row - starting_row;
-        subgrid_cols = ending_col - starting_col;
+        row_bounds = _even_bounds(proc_rows, grid_rows);
+        col_bounds = _even_bounds(proc_cols, grid_cols);
+        _decompose();
 
-        subgame = game.subgame(starting_row - 1, starting_col - 1, ending_row + 1, ending_col + 1);
+        // cell by cell, as the border wraps around the board and a subgrid can span all of it
+        subgame = GameOfLife(subgrid_rows + 2, subgrid_cols + 2);
+        for (size_t i = 0; i < subgrid_rows + 2; i++) {
+            for (size_t j = 0; j < subgrid_cols + 2; j++) {
+                subgame.set(i, j, game.get(starting_row - 1 + int(i), starting_col - 1 + int(j)));
+            }
+        }
 
         // Calculate ranks of the neighboring processes
-        neighbor_ranks[0] = coords_to_rank(proc_row - 1, proc_col);
-        neighbor_ranks[1] = coords_to_rank(proc_row + 1, proc_col);
-        neighbor_ranks[2] = coords_to_rank(proc_row, proc_col + 1);
-        neighbor_ranks[3] = coords_to_rank(proc_row, proc_col - 1);
+        _create_topology();
 
-        top_row_recv = new unsigned char[subgame.get_cols() / 8 + 1];
-        bottom_row_recv = new unsigned char[subgame.get_cols() / 8 + 1];
-        left_col_recv = new unsigned char[subgame.get_rows() / 8 + 1];
-        right_col_recv = new unsigned char[subgame.get_rows() / 8 + 1];
+        _allocate_buffers();
     }
     
     ~MPIProcess() {
-        delete[] top_row_recv;
-        delete[] bottom_row_recv;
-        delete[] left_col_recv;
-        delete[] right_col_recv;
+        _free_buffers();
+        int finalized;
+        MPI_Finalized(&finalized);
+        if (!finalized && neighbor_group != MPI_GROUP_NULL) MPI_Group_free(&neighbor_group);
+        if (!finalized && node_comm != MPI_COMM_NULL) MPI_Comm_free(&node_comm);
+        if (!finalized && cart_comm != MPI_COMM_NULL) MPI_Comm_free(&cart_comm);
     }
 
     // Maps a rank to row and column coordinates in the process grid
@@ -88,65 +623,281 @@ public:
     }
 
     void exchange() {
-        MPI_Request requests[4];
-        MPI_Status statuses[4];
-
-        std::vector<unsigned char> top_row_send = subgame.get_row(1);
-        std::vector<unsigned char> bottom_row_send = subgame.get_row(-2);
-        
-        // Send and receive the border rows
-        MPI_Isend(top_row_send.data(), top_row_send.size(), MPI_UNSIGNED_CHAR, neighbor_ranks[0], 0, MPI_COMM_WORLD, &requests[0]);
-        MPI_Isend(bottom_row_send.data(), bottom_row_send.size(), MPI_UNSIGNED_CHAR, neighbor_ranks[1], 0, MPI_COMM_WORLD, &requests[1]);
-        MPI_Recv(bottom_row_recv, bottom_row_send.size(), MPI_UNSIGNED_CHAR, neighbor_ranks[1], 0, MPI_COMM_WORLD, &statuses[1]);
-        MPI_Recv(top_row_recv, top_row_send.size(), MPI_UNSIGNED_CHAR, neighbor_ranks[0], 0, MPI_COMM_WORLD, &statuses[0]);
-
-        subgame.set_row(0, top_row_recv);
-        subgame.set_row(-1, bottom_row_recv);
-        std::vector<unsigned char> left_col_send = subgame.get_col(1);
-        std::vector<unsigned char> right_col_send = subgame.get_col(-2);
-        
-        // Send and receive the border columns
-        MPI_Isend(left_col_send.data(), left_col_send.size(), MPI_UNSIGNED_CHAR, neighbor_ranks[3], 0, MPI_COMM_WORLD, &requests[2]);
-        MPI_Isend(right_col_send.data(), right_col_send.size(), MPI_UNSIGNED_CHAR, neighbor_ranks[2], 0, MPI_COMM_WORLD, &requests[3]);
-        MPI_Recv(right_col_recv, right_col_send.size(), MPI_UNSIGNED_CHAR, neighbor_ranks[2], 0, MPI_COMM_WORLD, &statuses[3]);
-        MPI_Recv(left_col_recv, left_col_send.size(), MPI_UNSIGNED_CHAR, neighbor_ranks[3], 0, MPI_COMM_WORLD, &statuses[2]);
-
-        subgame.set_col(0, left_col_recv);
-        subgame.set_col(-1, right_col_recv);
-
-        MPI_Waitall(4, requests, statuses);
+        _exchange_halo();
+        _apply_halo();
+    }
+
+    // Width of the ghost border. With a halo of k cells, step() exchanges k rows and columns with each
+    // neighbor once every k generations and computes the generations in between locally, on a ghost
+    // border that shrinks by one cell per generation. That is k times fewer message latencies for a
+    // little redundant work.
+    void set_halo(size_t k) {
+        if (k == 0 || k > _smallest_block(row_bounds) || k > _smallest_block(col_bounds)) {
+            throw std::invalid_argument("The halo must be between 1 and the size of the smallest subgrid");
+        }
+        GameOfLife resized(subgrid_rows + 2 * k, subgrid_cols + 2 * k);
+        resized.set_kernel(subgame.get_kernel());
+        resized.set_threads(subgame.get_threads());
+        for (size_t i = 0; i < subgrid_rows; i++) {
+            for (size_t j = 0; j < subgrid_cols; j++) {
+                resized.set(k + i, k + j, subgame.get(halo + i, halo + j));
+            }
+        }
+        subgame = std::move(resized);
+        halo = k;
+        phase = 0; // the new ghost cells are received by the next step
+        _allocate_buffers();
+    }
+
+    size_t get_halo() const { return halo; }
+
+    // Number of threads ticking the subgame of this rank, 0 for one per hardware thread. With one rank
+    // per node or NUMA domain instead of one per core, there are far fewer halo messages per generation.
+    void set_threads(size_t threads) {
+        subgame.set_threads(threads);
+    }
+
+    size_t get_threads() const { return subgame.get_threads(); }
+
+    // Exchanges the halo on a dedicated thread in step(), while the interior is computed. It calls MPI
+    // outside of the main thread, which needs init_mpi_threads(..., true).
+    void set_comm_thread(bool enabled) {
+        if (enabled) {
+            int provided;
+            MPI_Query_thread(&provided);
+            if (provided < MPI_THREAD_SERIALIZED) {
+                throw std::runtime_error("A communication thread needs MPI_THREAD_SERIALIZED");
+            }
+        }
+        comm_team.reset(enabled ? new ThreadTeam(2) : nullptr);
+    }
+
+    bool get_comm_thread() const { return comm_team != nullptr; }
+
+    // Switches between the two-sided and the one-sided halo exchange. Every rank must call it, since
+    // the RMA windows are created collectively.
+    void set_halo_backend(HaloBackend _backend) {
+        backend = _backend;
+        _allocate_buffers();
+    }
+
+    HaloBackend get_halo_backend() const { return backend; }
+
+    // Moves the boundaries between the rows and the columns of processes so that every row and column of
+    // processes holds about the same number of living cells, and migrates the cells that change owner.
+    // With active tiles, the work of a rank follows the activity of its subgrid rather than its area, and
+    // patterns drift across the torus. The process grid stays a grid, so the neighbors do not change.
+    // Every rank must call it.
+    void rebalance() {
+        // the load of every row and column of the board: its living cells, plus one so that empty
+        // parts of the board are still split by area
+        std::vector<uint64_t> row_load(grid_rows, 0), col_load(grid_cols, 0);
+        for (size_t i = 0; i < subgrid_rows; i++) {
+            const uint64_t* row = subgame.row_data(halo + i);
+            row_load[starting_row + i] += 1;
+            for (size_t w = halo >> 6; w <= (halo + subgrid_cols - 1) >> 6; w++) {
+                for (uint64_t bits = row[w]; bits != 0; bits &= bits - 1) {
+                    const size_t col = (w << 6) + __builtin_ctzll(bits);
+                    if (col < halo || col >= halo + subgrid_cols) continue;
+                    row_load[starting_row + i]++;
+                    col_load[starting_col + col - halo]++;
+                }
+            }
+        }
+        for (size_t j = 0; j < subgrid_cols; j++) col_load[starting_col + j] += 1;
+        MPI_Allreduce(MPI_IN_PLACE, row_load.data(), grid_rows, MPI_UINT64_T, MPI_SUM, cart_comm);
+        MPI_Allreduce(MPI_IN_PLACE, col_load.data(), grid_cols, MPI_UINT64_T, MPI_SUM, cart_comm);
+
+        std::vector<size_t> new_row_bounds = _balanced_bounds(row_load, proc_rows, halo);
+        std::vector<size_t> new_col_bounds = _balanced_bounds(col_load, proc_cols, halo);
+        if (new_row_bounds == row_bounds && new_col_bounds == col_bounds) return; // the same on every rank
+
+        // Every rank sends the part of its subgrid that each rank owns from now on, packed row by row
+        const int size = proc_rows * proc_cols;
+        std::vector<int> send_counts(size), send_displs(size), recv_counts(size), recv_displs(size);
+        auto overlap = [](size_t begin, size_t end, size_t other_begin, size_t other_end, size_t& from, size_t& to) {
+            from = std::max(begin, other_begin);
+            to = std::min(end, other_end);
+            return from < to;
+        };
+        // the cells of the block of `owner` under the owner bounds that are in the block of `other` under the other bounds
+        auto intersect = [&](int owner, const std::vector<size_t>& owner_rows, const std::vector<size_t>& owner_cols,
+                             int other, const std::vector<size_t>& other_rows, const std::vector<size_t>& other_cols,
+                             size_t& row_begin, size_t& row_end, size_t& col_begin, size_t& col_end) {
+            int owner_row, owner_col, other_row, other_col;
+            rank_to_coords(owner, owner_row, owner_col);
+            rank_to_coords(other, other_row, other_col);
+            return overlap(owner_rows[owner_row], owner_rows[owner_row + 1], other_rows[other_row], other_rows[other_row + 1], row_begin, row_end) &&
+                   overlap(owner_cols[owner_col], owner_cols[owner_col + 1], other_cols[other_col], other_cols[other_col + 1], col_begin, col_end);
+        };
+
+        size_t row_begin, row_end, col_begin, col_end;
+        int send_total = 0, recv_total = 0;
+        for (int other = 0; other < size; other++) {
+            send_displs[other] = send_total;
+            if (intersect(rank, row_bounds, col_bounds, other, new_row_bounds, new_col_bounds, row_begin, row_end, col_begin, col_end)) {
+                send_total += (row_end - row_begin) * Grid::words_per_row(col_end - col_begin);
+            }
+            send_counts[other] = send_total - send_displs[other];
+            recv_displs[other] = recv_total;
+            if (intersect(other, row_bounds, col_bounds, rank, new_row_bounds, new_col_bounds, row_begin, row_end, col_begin, col_end)) {
+                recv_total += (row_end - row_begin) * Grid::words_per_row(col_end - col_begin);
+            }
+            recv_counts[other] = recv_total - recv_displs[other];
+        }
+
+        std::vector<uint64_t> send_buffer(send_total, 0), recv_buffer(recv_total);
+        for (int other = 0; other < size; other++) {
+            if (!intersect(rank, row_bounds, col_bounds, other, new_row_bounds, new_col_bounds, row_begin, row_end, col_begin, col_end)) continue;
+            uint64_t* packed = send_buffer.data() + send_displs[other];
+            const size_t words = Grid::words_per_row(col_end - col_begin);
+            for (size_t row = row_begin; row < row_end; row++, packed += words) {
+                copy_bits(packed, 0, subgame.row_data(halo + row - starting_row), halo + col_begin - starting_col, col_end - col_begin);
+            }
+        }
+        MPI_Alltoallv(send_buffer.data(), send_counts.data(), send_displs.data(), MPI_UINT64_T,
+                      recv_buffer.data(), recv_counts.data(), recv_displs.data(), MPI_UINT64_T, cart_comm);
+
+        // Unpacks the received parts into a subgame of the new size
+        const std::vector<size_t> old_row_bounds = row_bounds, old_col_bounds = col_bounds;
+        row_bounds = new_row_bounds;
+        col_bounds = new_col_bounds;
+        _decompose();
+        GameOfLife resized(subgrid_rows + 2 * halo, subgrid_cols + 2 * halo);
+        resized.set_kernel(subgame.get_kernel());
+        resized.set_threads(subgame.get_threads());
+        for (int other = 0; other < size; other++) {
+            if (!intersect(other, old_row_bounds, old_col_bounds, rank, row_bounds, col_bounds, row_begin, row_end, col_begin, col_end)) continue;
+            const uint64_t* packed = recv_buffer.data() + recv_displs[other];
+            const size_t words = Grid::words_per_row(col_end - col_begin);
+            for (size_t row = row_begin; row < row_end; row++, packed += words) {
+                copy_bits(resized.row_data(halo + row - starting_row), halo + col_begin - starting_col, packed, 0, col_end - col_begin);
+            }
+        }
+        resized.mark_rows(0, resized.get_rows());
+        subgame = std::move(resized);
+        phase = 0; // the ghost cells are received by the next step
+        _allocate_buffers();
+    }
+
+    // Calls rebalance() from step() every `generations` generations, 0 to keep the decomposition fixed
+    void set_balance_interval(size_t generations) { balance_interval = generations; }
+
+    size_t get_balance_interval() const { return balance_interval; }
+
+    // One generation. Every `halo` generations the halo is exchanged, with all eight neighbors at once,
+    // and the interior, which does not need the ghost cells, is computed while the messages are in flight.
+    void step() {
+        const size_t rows = subgame.get_rows(), cols = subgame.get_cols();
+        // `phase` generations after the exchange, the ghost cells within `phase` cells of the edge are
+        // stale. Only the cells whose neighbors are all valid are computed.
+        const size_t row_begin = phase + 1, row_end = rows - phase - 1;
+        const size_t word_begin = (phase + 1) >> 6, word_end = ((cols - phase - 2) >> 6) + 1;
+        if (phase > 0) {
+            subgame.tick_region(row_begin, row_end, word_begin, word_end);
+        } else {
+            size_t inner_row_begin, inner_row_end, inner_word_begin, inner_word_end;
+            _interior(inner_row_begin, inner_row_end, inner_word_begin, inner_word_end);
+            if (inner_row_begin >= inner_row_end || inner_word_begin >= inner_word_end) {
+                inner_row_begin = inner_row_end = row_begin;
+                inner_word_begin = inner_word_end = word_begin;
+            }
+
+            if (comm_team) {
+                comm_team->run([&](size_t member) {
+                    if (member == 1) _exchange_halo();
+                    else subgame.tick_region(inner_row_begin, inner_row_end, inner_word_begin, inner_word_end);
+                });
+            } else {
+                _post_halo();
+                subgame.tick_region(inner_row_begin, inner_row_end, inner_word_begin, inner_word_end);
+                _wait_halo();
+            }
+            _apply_halo();
+
+            // the frame around the interior
+            subgame.tick_region(row_begin, inner_row_begin, word_begin, word_end);
+            subgame.tick_region(inner_row_end, row_end, word_begin, word_end);
+            subgame.tick_region(inner_row_begin, inner_row_end, word_begin, inner_word_begin);
+            subgame.tick_region(inner_row_begin, inner_row_end, inner_word_end, word_end);
+        }
+        subgame.finish_tick();
+        phase = (phase + 1) % halo;
+        if (balance_interval && ++generation % balance_interval == 0) rebalance();
     }
 
+    // Gathers the whole board on the root, the other ranks get an empty game
     GameOfLife gather_subgrids() const {
-        int sendcount = ((grid_rows / proc_rows) + MOD(grid_rows, proc_rows)) * ((grid_cols / proc_cols) + MOD(grid_cols, proc_cols)) / 8 + 1;
-        unsigned char* recv_buffer = nullptr;
+        return gather_subgrids(0, 0, grid_rows, grid_cols);
+    }
+
+    // Gathers the rows [start_row, end_row) and columns [start_col, end_col) of the board on the root.
+    // Every rank sends only its part of the rectangle, packed row by row, with the exact counts for
+    // MPI_Gatherv, and the root copies the parts into place a word at a time.
+    GameOfLife gather_subgrids(size_t start_row, size_t start_col, size_t end_row, size_t end_col) const {
+        if (start_row > end_row || end_row > grid_rows || start_col > end_col || end_col > grid_cols) {
+            throw std::invalid_argument("The rectangle to gather must lie within the board");
+        }
+
+        // the part of the rectangle held by the rank at (row, col) of the process grid, false if none
+        auto part = [&](int row, int col, size_t& row_begin, size_t& row_end, size_t& col_begin, size_t& col_end) {
+            row_begin = std::max<size_t>(start_row, row_bounds[row]);
+            row_end = std::min<size_t>(end_row, row_bounds[row + 1]);
+            col_begin = std::max<size_t>(start_col, col_bounds[col]);
+            col_end = std::min<size_t>(end_col, col_bounds[col + 1]);
+            return row_begin < row_end && col_begin < col_end;
+        };
+
+        size_t row_begin, row_end, col_begin, col_end;
+        std::vector<uint64_t> send_buffer;
+        if (part(proc_row, proc_col, row_begin, row_end, col_begin, col_end)) {
+            const size_t words = Grid::words_per_row(col_end - col_begin);
+            send_buffer.assign((row_end - row_begin) * words, 0);
+            for (size_t row = row_begin; row < row_end; row++) {
+                copy_bits(send_buffer.data() + (row - row_begin) * words, 0, subgame.row_data(halo + row - starting_row),
+                          halo + col_begin - starting_col, col_end - col_begin);
+            }
+        }
+
+        const int size = proc_rows * proc_cols;
+        std::vector<int> counts, displs;
+        std::vector<uint64_t> recv_buffer;
         if (rank == root) {
-            recv_buffer = new unsigned char[sendcount * proc_rows * proc_cols];
+            counts.resize(size);
+            displs.resize(size);
+            int total = 0;
+            for (int other = 0; other < size; other++) {
+                int row, col;
+                rank_to_coords(other, row, col);
+                displs[other] = total;
+                counts[other] = part(row, col, row_begin, row_end, col_begin, col_end)
+                              ? (row_end - row_begin) * Grid::words_per_row(col_end - col_begin) : 0;
+                total += counts[other];
+            }
+            recv_buffer.resize(total);
         }
-        GameOfLife send_subgame = subgame.subgame(1, 1, -1, -1);
-        unsigned char* send_buffer = new unsigned char[sendcount];
-        memcpy(send_buffer, send_subgame.data(), send_subgame.size());
-        for (size_t i = send_subgame.size(); i < sendcount; i++) send_buffer[i] = 0;
-        
-        MPI_Gather(send_buffer, sendcount, MPI_UNSIGNED_CHAR, recv_buffer, sendcount, MPI_UNSIGNED_CHAR, root, MPI_COMM_WORLD);
+        MPI_Gatherv(send_buffer.data(), send_buffer.size(), MPI_UINT64_T,
+                    recv_buffer.data(), counts.data(), displs.data(), MPI_UINT64_T, root, MPI_COMM_WORLD);
 
         if (rank != root) return GameOfLife(0, 0);
 
-        GameOfLife game(grid_rows, grid_cols);
-        for (int i = 0; i < proc_rows; i++) {
-            for (int j = 0; j < proc_cols; j++) {
-                Grid current_sub_grid((i == proc_rows - 1) ? grid_rows - i * subgrid_rows : subgrid_rows,
-                                      (j == proc_cols - 1) ? grid_cols - j * subgrid_cols : subgrid_cols,
-                                      recv_buffer + (i * proc_cols + j) * sendcount);
-                game.set_subgame(i * (grid_rows / proc_rows), j * (grid_cols / proc_cols), current_sub_grid);
-                current_sub_grid._nullify();
+        GameOfLife game(end_row - start_row, end_col - start_col);
+        for (int other = 0; other < size; other++) {
+            int row, col;
+            rank_to_coords(other, row, col);
+            if (!part(row, col, row_begin, row_end, col_begin, col_end)) continue;
+            const size_t words = Grid::words_per_row(col_end - col_begin);
+            for (size_t r = row_begin; r < row_end; r++) {
+                copy_bits(game.row_data(r - start_row), col_begin - start_col,
+                          recv_buffer.data() + displs[other] + (r - row_begin) * words, 0, col_end - col_begin);
             }
         }
-        delete[] recv_buffer;
+        game.mark_rows(0, game.get_rows());
         return game;
     }
 
     void to_pgm(const std::string&) const;
+    void to_pbm(const std::string&) const; // PBM P4, the file constructor reads both
     void initialize_from_pgm(const std::string&);
 
     // Accessors for the subgrid dimensions
@@ -157,8 +908,13 @@ public:
     size_t get_ending_row() const { return ending_row; }
     size_t get_ending_col() const { return ending_col; }
     int get_rank() const { return rank; }
+    // Tiles of the subgame (halo included) skipped by the last step, out of get_tile_count()
+    size_t get_skipped_tiles() const { return subgame.get_skipped_tiles(); }
+    size_t get_tile_count() const { return subgame.get_tile_count(); }
     int get_proc_row() const { return proc_row; }
     int get_proc_col() const { return proc_col; }
+    size_t get_proc_rows() const { return proc_rows; }
+    size_t get_proc_cols() const { return proc_cols; }
 
     void print() const {
         std::cout << "Rank: " << rank << " (" << proc_row << ", " << proc_col << ")\n";
@@ -195,49 +951,109 @@ void MPIProcess::to_pgm(const std::string& filename) const {
     // Broadcast the size of the header to all processes
     MPI_Bcast(&header_size, 1, MPI_INT, root, MPI_COMM_WORLD);
 
-    // Synchronize before writing data
-    MPI_Barrier(MPI_COMM_WORLD);
+    // Truncate what is left of a longer file
+    MPI_File_set_size(file, header_size + grid_rows * grid_cols);
 
-    // Get the subgame data for this process, excluding the ghost border
-    GameOfLife subgame_without_border = subgame.subgame(1, 1, -1, -1);
+    // Expand the subgrid, without the ghost border, into bytes
+    std::vector<unsigned char> local_data(subgrid_rows * subgrid_cols);
+    for (size_t i = 0; i < subgrid_rows; ++i) {
+        expand_bits(&local_data[i * subgrid_cols], subgame.row_data(halo + i), halo, subgrid_cols);
+    }
 
-    // Serialize the subgrid into a linear buffer of bytes
-    std::vector<unsigned char> local_data(subgame_without_border.get_rows() * subgame_without_border.get_cols());
-    for (size_t i = 0; i < subgame_without_border.get_rows(); ++i) {
-        for (size_t j = 0; j < subgame_without_border.get_cols(); ++j) {
-            local_data[i * subgame_without_border.get_cols() + j] = subgame_without_border.get(i, j) ? 1 : 0;
-        }
+    // The subgrid is a subarray of the pixels after the header. With it as the file view, all ranks
+    // write their subgrids in one collective call, which MPI-IO can merge into large contiguous writes.
+    int sizes[2] = {int(grid_rows), int(grid_cols)};
+    int subsizes[2] = {int(subgrid_rows), int(subgrid_cols)};
+    int starts[2] = {starting_row, starting_col};
+    MPI_Datatype file_type;
+    MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_UNSIGNED_CHAR, &file_type);
+    MPI_Type_commit(&file_type);
+    MPI_File_set_view(file, header_size, MPI_UNSIGNED_CHAR, file_type, "native", MPI_INFO_NULL);
+    MPI_File_write_at_all(file, 0, local_data.data(), local_data.size(), MPI_UNSIGNED_CHAR, &status);
+    MPI_Type_free(&file_type);
+
+    // Close the file
+    MPI_File_close(&file);
+}
+
+void MPIProcess::to_pbm(const std::string& filename) const {
+    MPI_File file;
+    MPI_Status status;
+    MPI_File_open(MPI_COMM_WORLD, filename.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file);
+
+    int header_size = 0;
+    if (rank == root) {
+        std::ostringstream header;
+        header << "P4\n" << grid_cols << " " << grid_rows << "\n";
+        std::string header_str = header.str();
+        header_size = header_str.size();
+        MPI_File_write(file, header_str.c_str(), header_size, MPI_CHAR, &status);
     }
+    MPI_Bcast(&header_size, 1, MPI_INT, root, MPI_COMM_WORLD);
+    MPI_File_set_size(file, header_size + grid_rows * ((grid_cols + 7) >> 3)); // no stale tail, like to_pgm()
 
-    // Calculate the offset for each process's data in the global file
-    MPI_Offset offset = header_size +
-                        starting_row * grid_cols +  // Offset to the starting row
-                        starting_col;              // Offset to the starting column in the row
+    // The byte of the pixels [8k, 8k + 8) of a row is written by the rank that holds pixel 8k, so
+    // that every byte is written once. The pixels of the byte past the end of the subgrid, at most
+    // seven, are held by the next ranks of the process row, which share their first pixels.
+    MPI_Comm row_comm;
+    MPI_Comm_split(cart_comm, proc_row, proc_col, &row_comm);
+    const size_t shared = std::min<size_t>(7, subgrid_cols);
+    std::vector<unsigned char> first_pixels(subgrid_rows), all_first_pixels(subgrid_rows * proc_cols);
+    for (size_t i = 0; i < subgrid_rows; i++) {
+        uint64_t word = 0;
+        copy_bits(&word, 0, subgame.row_data(halo + i), halo, shared);
+        first_pixels[i] = word;
+    }
+    MPI_Allgather(first_pixels.data(), subgrid_rows, MPI_UNSIGNED_CHAR, all_first_pixels.data(), subgrid_rows, MPI_UNSIGNED_CHAR, row_comm);
+    MPI_Comm_free(&row_comm);
 
-    // Write the subgrid data for this process
-    for (size_t i = 0; i < subgrid_rows; ++i) {
-        MPI_File_write_at(file, offset + i * grid_cols, &local_data[i * subgrid_cols], subgrid_cols, MPI_UNSIGNED_CHAR, &status);
+    const size_t byte_begin = (starting_col + 7) >> 3, byte_end = (ending_col + 7) >> 3;
+    const size_t row_bytes = byte_end - byte_begin;
+    const size_t pixel_begin = byte_begin << 3, pixel_end = std::min(byte_end << 3, grid_cols);
+    std::vector<unsigned char> local_data(subgrid_rows * row_bytes);
+    std::vector<uint64_t> bits(Grid::words_per_row(row_bytes << 3));
+    for (size_t i = 0; row_bytes > 0 && i < subgrid_rows; i++) {
+        std::fill(bits.begin(), bits.end(), 0);
+        if (pixel_begin < size_t(ending_col)) {
+            copy_bits(bits.data(), 0, subgame.row_data(halo + i), halo + pixel_begin - starting_col, ending_col - pixel_begin);
+        }
+        for (size_t col = ending_col, owner = proc_col + 1; col < pixel_end; col++) {
+            while (col >= col_bounds[owner + 1]) owner++;
+            const uint64_t pixel = (all_first_pixels[owner * subgrid_rows + i] >> (col - col_bounds[owner])) & 1;
+            bits[(col - pixel_begin) >> 6] |= pixel << ((col - pixel_begin) & 63);
+        }
+        bits_to_pbm(&local_data[i * row_bytes], bits.data(), pixel_end - pixel_begin);
     }
 
-    // Close the file
+    // Collectively, through a file view of the bytes of the subgrid, like to_pgm()
+    if (row_bytes > 0) {
+        int sizes[2] = {int(grid_rows), int((grid_cols + 7) >> 3)};
+        int subsizes[2] = {int(subgrid_rows), int(row_bytes)};
+        int starts[2] = {starting_row, int(byte_begin)};
+        MPI_Datatype file_type;
+        MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_UNSIGNED_CHAR, &file_type);
+        MPI_Type_commit(&file_type);
+        MPI_File_set_view(file, header_size, MPI_UNSIGNED_CHAR, file_type, "native", MPI_INFO_NULL);
+        MPI_Type_free(&file_type);
+    } else {
+        MPI_File_set_view(file, header_size, MPI_UNSIGNED_CHAR, MPI_UNSIGNED_CHAR, "native", MPI_INFO_NULL); // nothing to write
+    }
+    MPI_File_write_at_all(file, 0, local_data.data(), local_data.size(), MPI_UNSIGNED_CHAR, &status);
+
     MPI_File_close(&file);
 }
 
-MPIProcess::MPIProcess(const std::string& filename, size_t proc_rows, size_t proc_cols, int root = 0)
-    : proc_rows(proc_rows), proc_cols(proc_cols), root(root) {
+MPIProcess::MPIProcess(const std::string& filename, size_t _proc_rows, size_t _proc_cols, int root = 0)
+    : proc_rows(_proc_rows), proc_cols(_proc_cols), root(root) {
     // Initialize MPI
     int size;
     MPI_Comm_size(MPI_COMM_WORLD, &size);
-    if (size != proc_rows * proc_cols) {
-        throw std::runtime_error("Number of processes must be equal to proc_rows * proc_cols");
-    }
-
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-    rank_to_coords(rank, proc_row, proc_col);
 
     // File header variables
     size_t global_rows, global_cols;
     MPI_Offset header_offset = 0;
+    int bitmap = 0; // PBM P4, with eight cells per byte, rather than PGM P5
 
     if (rank == root) {
         // Root reads the file header to determine global dimensions
@@ -248,13 +1064,18 @@ MPIProcess::MPIProcess(const std::string& filename, size_t proc_rows, size_t pro
 
         std::string magic;
         file >> magic;
-        if (magic != "P5") {
-            throw std::runtime_error("Unsupported file format (only PGM P5 is supported)");
+        if (magic != "P5" && magic != "P4") {
+            throw std::runtime_error("Unsupported file format (only PGM P5 and PBM P4 are supported)");
         }
+        bitmap = magic == "P4";
 
         file >> global_cols >> global_rows; // Read width and height
-        file.ignore(); // Skip the line with max intensity value
-        file.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Skip any extra newlines or carriage returns after header
+        if (bitmap) {
+            file.ignore(1); // A single whitespace character, there is no max intensity value
+        } else {
+            file.ignore(); // Skip the line with max intensity value
+            file.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Skip any extra newlines or carriage returns after header
+        }
         header_offset = file.tellg(); // Start of pixel data
     }
 
@@ -262,59 +1083,62 @@ MPIProcess::MPIProcess(const std::string& filename, size_t proc_rows, size_t pro
     MPI_Bcast(&global_rows, 1, MPI_UNSIGNED_LONG, root, MPI_COMM_WORLD);
     MPI_Bcast(&global_cols, 1, MPI_UNSIGNED_LONG, root, MPI_COMM_WORLD);
     MPI_Bcast(&header_offset, sizeof(header_offset), MPI_BYTE, root, MPI_COMM_WORLD);
+    MPI_Bcast(&bitmap, 1, MPI_INT, root, MPI_COMM_WORLD);
 
     grid_rows = global_rows;
     grid_cols = global_cols;
 
+    // The process grid can only be chosen once the shape of the board is known
+    choose_proc_grid(size, grid_rows, grid_cols, proc_rows, proc_cols);
+    rank_to_coords(rank, proc_row, proc_col);
+
     // Compute the dimensions of the subgrid for this process
-    subgrid_rows = grid_rows / proc_rows;
-    subgrid_cols = grid_cols / proc_cols;
-    starting_row = proc_row * subgrid_rows;
-    starting_col = proc_col * subgrid_cols;
-    ending_row = (proc_row == proc_rows - 1) ? grid_rows : starting_row + subgrid_rows;
-    ending_col = (proc_col == proc_cols - 1) ? grid_cols : starting_col + subgrid_cols;
-    subgrid_rows = ending_row - starting_row;
-    subgrid_cols = ending_col - starting_col;
+    row_bounds = _even_bounds(proc_rows, grid_rows);
+    col_bounds = _even_bounds(proc_cols, grid_cols);
+    _decompose();
 
     // Allocate space for the local subgame (including border)
     subgame = GameOfLife(subgrid_rows + 2, subgrid_cols + 2); // +2 for borders
 
-    // Allocate local data buffer for subgrid
-    unsigned char* local_data = new unsigned char[subgrid_rows * subgrid_cols];
-
-    // Read the subgrid data using MPI I/O
+    // Read the subgrid through a file view of its subarray of the pixels, collectively, so that MPI-IO
+    // can turn the reads of all ranks into a few large contiguous ones. A bitmap is read as the bytes
+    // that hold the pixels of the subgrid, exactly.
+    const size_t byte_begin = bitmap ? starting_col >> 3 : starting_col;
+    const size_t byte_end = bitmap ? (ending_col + 7) >> 3 : ending_col;
+    const size_t row_bytes = byte_end - byte_begin;
+    std::vector<unsigned char> local_data(subgrid_rows * row_bytes);
     MPI_File mpi_file;
     MPI_File_open(MPI_COMM_WORLD, filename.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &mpi_file);
-
-    for (size_t i = 0; i < subgrid_rows; i++) {
-        // Calculate the exact offset in the global PGM data for this row
-        MPI_Offset file_offset = header_offset + (starting_row + i) * grid_cols + starting_col;
-        MPI_File_read_at(mpi_file, file_offset, local_data + i * subgrid_cols, subgrid_cols, MPI_UNSIGNED_CHAR, MPI_STATUS_IGNORE);
-    }
+    int sizes[2] = {int(grid_rows), int(bitmap ? (grid_cols + 7) >> 3 : grid_cols)};
+    int subsizes[2] = {int(subgrid_rows), int(row_bytes)};
+    int starts[2] = {starting_row, int(byte_begin)};
+    MPI_Datatype file_type;
+    MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_UNSIGNED_CHAR, &file_type);
+    MPI_Type_commit(&file_type);
+    MPI_File_set_view(mpi_file, header_offset, MPI_UNSIGNED_CHAR, file_type, "native", MPI_INFO_NULL);
+    MPI_File_read_at_all(mpi_file, 0, local_data.data(), local_data.size(), MPI_UNSIGNED_CHAR, MPI_STATUS_IGNORE);
+    MPI_Type_free(&file_type);
 
     // Close the MPI file
     MPI_File_close(&mpi_file);
 
-    // Populate the subgame grid with the data from the local buffer
+    // Pack the pixels into the rows of the subgame, next to the ghost border
+    std::vector<uint64_t> bits(bitmap ? Grid::words_per_row(row_bytes << 3) : 0);
     for (size_t i = 0; i < subgrid_rows; i++) {
-        for (size_t j = 0; j < subgrid_cols; j++) {
-            subgame.set(i + 1, j + 1, local_data[i * subgrid_cols + j]); // Offset for borders
+        if (bitmap) {
+            pbm_to_bits(bits.data(), &local_data[i * row_bytes], row_bytes << 3);
+            copy_bits(subgame.row_data(i + 1), 1, bits.data(), starting_col - (byte_begin << 3), subgrid_cols);
+        } else {
+            pack_bytes(subgame.row_data(i + 1), 1, &local_data[i * row_bytes], subgrid_cols);
         }
     }
-
-    delete[] local_data;
+    subgame.mark_rows(0, subgame.get_rows());
 
     // Calculate the ranks of the neighboring processes
-    neighbor_ranks[0] = coords_to_rank(proc_row - 1, proc_col);  // North
-    neighbor_ranks[1] = coords_to_rank(proc_row + 1, proc_col);  // South
-    neighbor_ranks[2] = coords_to_rank(proc_row, proc_col + 1);  // East
-    neighbor_ranks[3] = coords_to_rank(proc_row, proc_col - 1);  // West
+    _create_topology();
 
     // Allocate buffers for exchanging border data
-    top_row_recv = new unsigned char[subgame.get_cols() / 8 + 1];
-    bottom_row_recv = new unsigned char[subgame.get_cols() / 8 + 1];
-    left_col_recv = new unsigned char[subgame.get_rows() / 8 + 1];
-    right_col_recv = new unsigned char[subgame.get_rows() / 8 + 1];
+    _allocate_buffers();
 }
 
 #endif
\ No newline at end of file
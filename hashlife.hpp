@@ -0,0 +1,427 @@
+#ifndef HASHLIFE_HPP
+#define HASHLIFE_HPP
+
+#include "game_of_life.hpp"
+#include <unordered_map>
+#include <sstream>
+#include <stdexcept>
+
+// HashLife: the universe is a quadtree of canonical nodes. Every distinct square exists only once
+// (hash consing), and the result of advancing a node is memoized in the node, so regular patterns
+// can be advanced by millions of generations in a few steps.
+// Unlike GameOfLife, which is a torus, HashLife simulates the unbounded plane. The root node is
+// centered at the origin and grows whenever cells are set outside of it or a step needs space.
+class HashLife {
+    static constexpr uint32_t NONE = 0xffffffff;
+
+    struct Node {
+        uint32_t nw, ne, sw, se; // children, level 0 nodes (cells) have none
+        uint32_t result;         // memoized center after 2^(level - 2) generations, see _successor
+        uint32_t level;          // the node covers 2^level x 2^level cells
+        uint64_t population;
+    };
+
+    struct Key {
+        uint32_t nw, ne, sw, se;
+        bool operator==(const Key& other) const {
+            return nw == other.nw && ne == other.ne && sw == other.sw && se == other.se;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            uint64_t h = key.nw * 0x9e3779b97f4a7c15ull;
+            h = (h ^ key.ne) * 0xff51afd7ed558ccdull;
+            h = (h ^ key.sw) * 0xc4ceb9fe1a85ec53ull;
+            h = (h ^ key.se) * 0x9e3779b97f4a7c15ull;
+            return h ^ (h >> 32);
+        }
+    };
+
+    std::vector<Node> nodes;                        // nodes[0] is the dead cell, nodes[1] the living cell
+    std::unordered_map<Key, uint32_t, KeyHash> table;
+    std::vector<uint32_t> empty_nodes;              // empty node of each level
+    uint32_t root;
+    uint64_t generation = 0;
+    std::unordered_map<uint64_t, uint32_t> slow_results; // centers after 2^k < 2^(level - 2) generations, by node << 8 | k
+    size_t gc_threshold = 1 << 20;
+
+    uint32_t _join(uint32_t nw, uint32_t ne, uint32_t sw, uint32_t se) {
+        Key key = {nw, ne, sw, se};
+        auto it = table.find(key);
+        if (it != table.end()) return it->second;
+
+        Node node = {nw, ne, sw, se, NONE, nodes[nw].level + 1,
+                     nodes[nw].population + nodes[ne].population + nodes[sw].population + nodes[se].population};
+        uint32_t index = nodes.size();
+        nodes.push_back(node);
+        table.emplace(key, index);
+        return index;
+    }
+
+    uint32_t _empty(uint32_t level) {
+        while (empty_nodes.size() <= level) {
+            uint32_t e = empty_nodes.back();
+            empty_nodes.push_back(_join(e, e, e, e));
+        }
+        return empty_nodes[level];
+    }
+
+    // Center of a node, one level below
+    uint32_t _center(uint32_t n) {
+        const Node& node = nodes[n];
+        return _join(nodes[node.nw].se, nodes[node.ne].sw, nodes[node.sw].ne, nodes[node.se].nw);
+    }
+
+    // Places the root in the center of a node twice its size
+    void _expand() {
+        const Node r = nodes[root];
+        uint32_t e = _empty(r.level - 1);
+        root = _join(_join(e, e, e, r.nw), _join(e, e, r.ne, e), _join(e, r.sw, e, e), _join(r.se, e, e, e));
+    }
+
+    // A level 2 node (4x4 cells) as index into LifeTables::next_4x4
+    unsigned _cells_4x4(uint32_t n) const {
+        const Node& node = nodes[n];
+        const uint32_t quadrants[4] = {node.nw, node.ne, node.sw, node.se};
+        unsigned cells = 0;
+        for (unsigned q = 0; q < 4; q++) {
+            const Node& quadrant = nodes[quadrants[q]];
+            unsigned offset = 8 * (q >> 1) + 2 * (q & 1);
+            cells |= (quadrant.nw << offset) | (quadrant.ne << (offset + 1)) | (quadrant.sw << (offset + 4)) | (quadrant.se << (offset + 5));
+        }
+        return cells;
+    }
+
+    // Center of node n (level L) advanced by 2^min(k, L - 2) generations. The full step is memoized in the
+    // node, the smaller ones in slow_results, so steps of different sizes keep each other's results.
+    uint32_t _successor(uint32_t n, unsigned k) {
+        const Node node = nodes[n];
+        const bool full = k >= node.level - 2;
+        const uint64_t key = (uint64_t(n) << 8) | k;
+        if (full && node.result != NONE) return node.result;
+        if (!full) {
+            auto it = slow_results.find(key);
+            if (it != slow_results.end()) return it->second;
+        }
+        uint32_t result;
+
+        if (node.population == 0) {
+            result = _empty(node.level - 1);
+        } else if (node.level == 2) {
+            unsigned next = life_tables.next_4x4[_cells_4x4(n)];
+            result = _join(next & 1, (next >> 1) & 1, (next >> 2) & 1, (next >> 3) & 1);
+        } else {
+            const Node nw = nodes[node.nw], ne = nodes[node.ne], sw = nodes[node.sw], se = nodes[node.se];
+            // the nine overlapping subsquares of level L - 1
+            uint32_t n00 = node.nw,                          n01 = _join(nw.ne, ne.nw, nw.se, ne.sw), n02 = node.ne;
+            uint32_t n10 = _join(nw.sw, nw.se, sw.nw, sw.ne), n11 = _join(nw.se, ne.sw, sw.ne, se.nw), n12 = _join(ne.sw, ne.se, se.nw, se.ne);
+            uint32_t n20 = node.sw,                          n21 = _join(sw.ne, se.nw, sw.se, se.sw), n22 = node.se;
+
+            if (full) {
+                // full speed: two rounds of 2^(L - 3) generations
+                n00 = _successor(n00, k); n01 = _successor(n01, k); n02 = _successor(n02, k);
+                n10 = _successor(n10, k); n11 = _successor(n11, k); n12 = _successor(n12, k);
+                n20 = _successor(n20, k); n21 = _successor(n21, k); n22 = _successor(n22, k);
+            } else {
+                // smaller step: only the second round advances the cells
+                n00 = _center(n00); n01 = _center(n01); n02 = _center(n02);
+                n10 = _center(n10); n11 = _center(n11); n12 = _center(n12);
+                n20 = _center(n20); n21 = _center(n21); n22 = _center(n22);
+            }
+            result = _join(_successor(_join(n00, n01, n10, n11), k), _successor(_join(n01, n02, n11, n12), k),
+                           _successor(_join(n10, n11, n20, n21), k), _successor(_join(n11, n12, n21, n22), k));
+        }
+        if (full) nodes[n].result = result;
+        else slow_results.emplace(key, result);
+        return result;
+    }
+
+    // The root has a margin of three quarters of its half width on every side
+    bool _root_has_margin() const {
+        const Node& r = nodes[root];
+        const Node &nw = nodes[r.nw], &ne = nodes[r.ne], &sw = nodes[r.sw], &se = nodes[r.se];
+        return nodes[nodes[nw.se].se].population + nodes[nodes[ne.sw].sw].population
+             + nodes[nodes[sw.ne].ne].population + nodes[nodes[se.nw].nw].population == r.population;
+    }
+
+    int64_t _half_width() const {
+        return int64_t(1) << (nodes[root].level - 1);
+    }
+
+    uint32_t _set(uint32_t n, int64_t row, int64_t col, bool val) { // row and col relative to the top left corner of n
+        const Node node = nodes[n];
+        if (node.level == 0) return val ? 1 : 0;
+        const int64_t half = int64_t(1) << (node.level - 1);
+        if (row < half) {
+            if (col < half) return _join(_set(node.nw, row, col, val), node.ne, node.sw, node.se);
+            return _join(node.nw, _set(node.ne, row, col - half, val), node.sw, node.se);
+        }
+        if (col < half) return _join(node.nw, node.ne, _set(node.sw, row - half, col, val), node.se);
+        return _join(node.nw, node.ne, node.sw, _set(node.se, row - half, col - half, val));
+    }
+
+    // Node of the given level whose top left corner is cell (row, col) of the game
+    uint32_t _from_game(const GameOfLife& game, uint32_t level, int64_t row, int64_t col) {
+        const int64_t size = int64_t(1) << level;
+        if (row >= static_cast<int64_t>(game.get_rows()) || col >= static_cast<int64_t>(game.get_cols())) return _empty(level);
+        if (level == 0) return game.get(row, col);
+        if (level <= 6) {
+            // at most 64 columns, aligned to a word: skip empty squares with one test per row
+            const uint64_t mask = (level == 6) ? ~uint64_t(0) : ((uint64_t(1) << size) - 1) << (col & 63);
+            bool empty = true;
+            for (int64_t i = row; i < row + size && i < static_cast<int64_t>(game.get_rows()); i++) {
+                if (game.row_data(i)[col >> 6] & mask) {
+                    empty = false;
+                    break;
+                }
+            }
+            if (empty) return _empty(level);
+        }
+        const int64_t half = size / 2;
+        return _join(_from_game(game, level - 1, row, col), _from_game(game, level - 1, row, col + half),
+                     _from_game(game, level - 1, row + half, col), _from_game(game, level - 1, row + half, col + half));
+    }
+
+    // Copies the living cells of node n, whose top left corner is at (row, col), into the game window
+    void _to_game(uint32_t n, int64_t row, int64_t col, GameOfLife& game, int64_t start_row, int64_t start_col) const {
+        const Node& node = nodes[n];
+        const int64_t size = int64_t(1) << node.level;
+        if (node.population == 0 || row >= start_row + static_cast<int64_t>(game.get_rows()) || col >= start_col + static_cast<int64_t>(game.get_cols())
+            || row + size <= start_row || col + size <= start_col) return;
+        if (node.level == 0) {
+            game.set(row - start_row, col - start_col, true);
+            return;
+        }
+        const int64_t half = size / 2;
+        _to_game(node.nw, row, col, game, start_row, start_col);
+        _to_game(node.ne, row, col + half, game, start_row, start_col);
+        _to_game(node.sw, row + half, col, game, start_row, start_col);
+        _to_game(node.se, row + half, col + half, game, start_row, start_col);
+    }
+
+    uint32_t _copy_reachable(uint32_t n, const std::vector<Node>& old_nodes, std::vector<uint32_t>& remap) {
+        if (remap[n] != NONE) return remap[n];
+        const Node& node = old_nodes[n];
+        uint32_t copy = _join(_copy_reachable(node.nw, old_nodes, remap), _copy_reachable(node.ne, old_nodes, remap),
+                              _copy_reachable(node.sw, old_nodes, remap), _copy_reachable(node.se, old_nodes, remap));
+        remap[n] = copy;
+        return copy;
+    }
+
+    void _reset() {
+        nodes.clear();
+        table.clear();
+        slow_results.clear();
+        nodes.push_back({NONE, NONE, NONE, NONE, NONE, 0, 0});
+        nodes.push_back({NONE, NONE, NONE, NONE, NONE, 0, 1});
+        empty_nodes.assign(1, 0);
+        root = _empty(3);
+    }
+
+public:
+    HashLife() {
+        _reset();
+    }
+
+    // Imports the game with cell (i, j) of the game at (i, j) of the plane
+    explicit HashLife(const GameOfLife& game) {
+        _reset();
+        uint32_t level = 3;
+        while ((int64_t(1) << level) < static_cast<int64_t>(std::max(game.get_rows(), game.get_cols()))) level++;
+        uint32_t n = _from_game(game, level, 0, 0);
+        // (0, 0) is the center of the root, so the game goes into the south east quadrant of a root one level up
+        uint32_t e = _empty(level);
+        root = _join(e, e, e, n);
+    }
+
+    bool get(int64_t row, int64_t col) const {
+        const int64_t half = _half_width();
+        if (row < -half || row >= half || col < -half || col >= half) return false;
+        uint32_t n = root;
+        row += half;
+        col += half;
+        while (nodes[n].level > 0) {
+            const int64_t h = int64_t(1) << (nodes[n].level - 1);
+            const Node& node = nodes[n];
+            if (row < h) n = (col < h) ? node.nw : node.ne;
+            else n = (col < h) ? node.sw : node.se;
+            if (row >= h) row -= h;
+            if (col >= h) col -= h;
+        }
+        return n == 1;
+    }
+
+    void set(int64_t row, int64_t col, bool val) {
+        while (row < -_half_width() || row >= _half_width() || col < -_half_width() || col >= _half_width()) _expand();
+        root = _set(root, row + _half_width(), col + _half_width(), val);
+    }
+
+    // Advances the universe by 2^k generations
+    void step(unsigned k) {
+        while (nodes[root].level < k + 3 || !_root_has_margin()) _expand();
+        root = _successor(root, k);
+        while (nodes[root].level < 3) _expand(); // the smallest root, as written by to_macrocell
+        generation += uint64_t(1) << k;
+
+        if (nodes.size() > gc_threshold) {
+            collect_garbage();
+            if (nodes.size() > gc_threshold / 2) gc_threshold *= 2;
+        }
+    }
+
+    // Advances the universe by any number of generations, using the binary representation of n
+    void advance(uint64_t n) {
+        for (unsigned k = 0; n != 0; k++, n >>= 1) {
+            if (n & 1) step(k);
+        }
+    }
+
+    // Rebuilds the node table with only the nodes reachable from the root. Memoized results are dropped.
+    void collect_garbage() {
+        std::vector<Node> old_nodes;
+        old_nodes.swap(nodes);
+        uint32_t old_root = root;
+        _reset();
+        std::vector<uint32_t> remap(old_nodes.size(), NONE);
+        remap[0] = 0;
+        remap[1] = 1;
+        root = _copy_reachable(old_root, old_nodes, remap);
+    }
+
+    // Exports the window of the plane starting at (start_row, start_col), e.g. to write it with to_pgm
+    GameOfLife to_game(int64_t start_row, int64_t start_col, size_t rows, size_t cols) const {
+        GameOfLife game(rows, cols);
+        _to_game(root, -_half_width(), -_half_width(), game, start_row, start_col);
+        return game;
+    }
+
+    uint64_t get_generation() const { return generation; }
+    uint64_t population() const { return nodes[root].population; }
+    size_t node_count() const { return nodes.size(); }
+
+    void to_macrocell(const std::string&) const;
+    void initialize_from_macrocell(const std::string&);
+};
+
+
+// Macrocell format: leaves are 8x8 squares written with '.', '*' and '$' (end of row), inner nodes are
+// written as "level nw ne sw se", where the children refer to earlier node lines (1-based, 0 is empty).
+void HashLife::to_macrocell(const std::string& filename) const {
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+        throw std::ios_base::failure("Failed to open file");
+    }
+
+    file << "[M2] (Game-of-Life hashlife)\n";
+    file << "#R B3/S23\n";
+    file << "#G " << generation << "\n";
+
+    std::unordered_map<uint32_t, size_t> line_of;
+    size_t lines = 0;
+
+    // post order, so that children are written before their parents
+    std::vector<std::pair<uint32_t, bool>> stack({{root, false}});
+    while (!stack.empty()) {
+        auto [n, children_done] = stack.back();
+        stack.pop_back();
+        const Node& node = nodes[n];
+        if (node.population == 0 || line_of.count(n)) continue;
+
+        if (node.level == 3) {
+            for (int64_t row = 0; row < 8; row++) {
+                std::string line;
+                for (int64_t col = 0; col < 8; col++) {
+                    uint32_t c = n;
+                    for (uint32_t level = 3, r = row, cc = col; level > 0; level--) {
+                        const uint32_t h = 1u << (level - 1);
+                        const Node& cur = nodes[c];
+                        c = (r < h) ? ((cc < h) ? cur.nw : cur.ne) : ((cc < h) ? cur.sw : cur.se);
+                        if (r >= h) r -= h;
+                        if (cc >= h) cc -= h;
+                    }
+                    line += (c == 1) ? '*' : '.';
+                }
+                line.erase(line.find_last_not_of('.') + 1);
+                file << line << '$';
+            }
+            file << '\n';
+        } else if (!children_done) {
+            stack.push_back({n, true});
+            for (uint32_t child : {node.se, node.sw, node.ne, node.nw}) stack.push_back({child, false});
+            continue;
+        } else {
+            auto line = [&](uint32_t child) { return nodes[child].population == 0 ? 0 : line_of.at(child); };
+            file << node.level << ' ' << line(node.nw) << ' ' << line(node.ne) << ' ' << line(node.sw) << ' ' << line(node.se) << '\n';
+        }
+        line_of[n] = ++lines;
+    }
+    if (lines == 0) {
+        file << "$\n"; // empty universe: a single empty leaf
+    }
+    file.close();
+}
+
+void HashLife::initialize_from_macrocell(const std::string& filename) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        throw std::ios_base::failure("Failed to open file");
+    }
+
+    std::string line;
+    if (!std::getline(file, line) || line.compare(0, 2, "[M") != 0) {
+        throw std::invalid_argument("File is not in Macrocell format");
+    }
+
+    _reset();
+    generation = 0;
+    std::vector<uint32_t> node_of_line({NONE}); // line 0 stands for the empty node
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+
+        if (line[0] == '#') {
+            if (line.compare(0, 2, "#R") == 0) {
+                std::string rule = line.substr(2);
+                rule.erase(0, rule.find_first_not_of(' '));
+                if (rule != "B3/S23" && rule != "b3/s23" && rule != "23/3") {
+                    throw std::invalid_argument("Unsupported rule " + rule + ", only B3/S23 is supported");
+                }
+            } else if (line.compare(0, 2, "#G") == 0) {
+                generation = std::stoull(line.substr(2));
+            }
+        } else if (line[0] == '.' || line[0] == '*' || line[0] == '$') {
+            uint32_t n = _empty(3);
+            int64_t row = 0, col = 0;
+            for (char c : line) {
+                if (c == '$') {
+                    row++;
+                    col = 0;
+                } else {
+                    if (row >= 8 || col >= 8) throw std::invalid_argument("Macrocell leaf exceeds 8x8 cells");
+                    if (c == '*') n = _set(n, row, col, true);
+                    col++;
+                }
+            }
+            node_of_line.push_back(n);
+        } else {
+            std::istringstream fields(line);
+            uint32_t level;
+            size_t children[4];
+            if (!(fields >> level >> children[0] >> children[1] >> children[2] >> children[3]) || level < 4) {
+                throw std::invalid_argument("Invalid Macrocell node: " + line);
+            }
+            uint32_t child_nodes[4];
+            for (int i = 0; i < 4; i++) {
+                if (children[i] >= node_of_line.size()) throw std::invalid_argument("Macrocell node refers to a later node");
+                child_nodes[i] = children[i] == 0 ? _empty(level - 1) : node_of_line[children[i]];
+                if (nodes[child_nodes[i]].level != level - 1) throw std::invalid_argument("Macrocell node has children of the wrong level");
+            }
+            node_of_line.push_back(_join(child_nodes[0], child_nodes[1], child_nodes[2], child_nodes[3]));
+        }
+    }
+    if (node_of_line.size() > 1) root = node_of_line.back();
+    file.close();
+}
+
+#endif
@@ -0,0 +1,314 @@
+#ifndef LIFE_KERNELS_HPP
+#define LIFE_KERNELS_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+
+// Bit-parallel kernels for the Game of Life. A row is an array of 64 bit words, where cell `col` is
+// bit (col & 63) of word (col >> 6). Bits past the last column are always zero.
+// Instead of counting the neighbors of one cell at a time, the eight neighbor words are added with
+// full-/half-adders, so that every bit lane holds the neighbor count of its own cell.
+
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define LIFE_KERNELS_X86 1
+#else
+#define LIFE_KERNELS_X86 0
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define LIFE_INLINE inline __attribute__((always_inline)) // lets the SIMD kernels inline the generic code into their target ISA
+#else
+#define LIFE_INLINE inline
+#endif
+
+
+// The rule of the game: birth with 3 neighbors, survival with 2 or 3 (B3/S23).
+// The lookup tables are generated from it; the adder logic in next_generation implements the same rule.
+constexpr bool life_rule(bool alive, unsigned neighbors) {
+    return (neighbors == 3) || (neighbors == 2 && alive);
+}
+
+// Adds three one bit numbers in every lane. Word is uint64_t or a vector of them (GCC vector extension),
+// which both support the bitwise operators. Vectors are passed by reference, so that the generic code
+// does not depend on the vector calling convention of the target ISA.
+template <typename Word>
+LIFE_INLINE void full_add(const Word& a, const Word& b, const Word& c, Word& sum, Word& carry) {
+    Word t = a ^ b;
+    carry = (a & b) | (t & c);
+    sum = t ^ c;
+}
+
+// Next state of the 64 cells in c. a is the row above, b the row below; the _w and _e words
+// contain the west and east neighbor of each lane, i.e. the row shifted by one column.
+template <typename Word>
+LIFE_INLINE void next_generation(const Word& a_w, const Word& a, const Word& a_e,
+                                 const Word& c_w, const Word& c, const Word& c_e,
+                                 const Word& b_w, const Word& b, const Word& b_e, Word& next) {
+    Word a_1, a_2, b_1, b_2, ones, ones_2, twos, twos_4;
+    full_add(a_w, a, a_e, a_1, a_2);
+    full_add(b_w, b, b_e, b_1, b_2);
+    Word c_1 = c_w ^ c_e, c_2 = c_w & c_e;
+
+    full_add(a_1, b_1, c_1, ones, ones_2);
+    full_add(a_2, b_2, c_2, twos, twos_4);
+    Word fours = twos_4 | (twos & ones_2);
+    twos ^= ones_2;
+
+    // count = ones + 2*twos + 4*fours: a cell lives with 3 neighbors, or with 2 if it is alive
+    next = twos & ~fours & (ones | c);
+}
+
+inline uint64_t life_word(uint64_t a_w, uint64_t a, uint64_t a_e,
+                          uint64_t c_w, uint64_t c, uint64_t c_e,
+                          uint64_t b_w, uint64_t b, uint64_t b_e) {
+    uint64_t next;
+    next_generation(a_w, a, a_e, c_w, c, c_e, b_w, b, b_e, next);
+    return next;
+}
+
+// Mask of the valid bits in the last word of a row
+inline uint64_t last_word_mask(size_t cols) {
+    return (cols & 63) ? (uint64_t(1) << (cols & 63)) - 1 : ~uint64_t(0);
+}
+
+// Row shifted east by one column (lane j holds column j-1), wrapping around at the row ends
+inline uint64_t west_neighbors(const uint64_t* row, size_t w, size_t words, size_t cols) {
+    uint64_t carry = (w > 0) ? row[w - 1] >> 63 : (row[words - 1] >> ((cols - 1) & 63)) & 1;
+    return (row[w] << 1) | carry;
+}
+
+// Row shifted west by one column (lane j holds column j+1), wrapping around at the row ends
+inline uint64_t east_neighbors(const uint64_t* row, size_t w, size_t words, size_t cols) {
+    uint64_t carry = (w + 1 < words) ? row[w + 1] << 63 : (row[0] & 1) << ((cols - 1) & 63);
+    return (row[w] >> 1) | carry;
+}
+
+// Next state of word w of row cur, including the wraparound at the row ends
+inline uint64_t life_word_wrapped(const uint64_t* above, const uint64_t* cur, const uint64_t* below, size_t w, size_t words, size_t cols) {
+    return life_word(west_neighbors(above, w, words, cols), above[w], east_neighbors(above, w, words, cols),
+                     west_neighbors(cur, w, words, cols), cur[w], east_neighbors(cur, w, words, cols),
+                     west_neighbors(below, w, words, cols), below[w], east_neighbors(below, w, words, cols));
+}
+
+// Stores word w of the next generation and ORs the bits that changed into changes[w]
+inline void store_word(uint64_t* out, const uint64_t* cur, uint64_t* changes, size_t w, uint64_t next, size_t words, size_t cols) {
+    if (w + 1 == words) next &= last_word_mask(cols);
+    out[w] = next;
+    changes[w] |= next ^ cur[w];
+}
+
+// Computes the words [word_begin, word_end) of the next generation of row cur, given its neighbor
+// rows above and below. Rows have `words` words and `cols` cells and wrap around (torus).
+// The changed bits of every computed word are ORed into changes, which tracks the active tiles.
+// Only the first and the last word of a row wrap, the loop over the interior words has no branches.
+inline void life_row(const uint64_t* above, const uint64_t* cur, const uint64_t* below, uint64_t* out,
+                     size_t word_begin, size_t word_end, size_t words, size_t cols, uint64_t* changes) {
+    if (word_begin >= word_end) return;
+    size_t w = word_begin;
+    if (w == 0) {
+        store_word(out, cur, changes, 0, life_word_wrapped(above, cur, below, 0, words, cols), words, cols);
+        w = 1;
+    }
+    const size_t inner_end = (word_end < words) ? word_end : words - 1;
+    for (; w < inner_end; w++) {
+        uint64_t next = life_word((above[w] << 1) | (above[w - 1] >> 63), above[w], (above[w] >> 1) | (above[w + 1] << 63),
+                                  (cur[w] << 1) | (cur[w - 1] >> 63), cur[w], (cur[w] >> 1) | (cur[w + 1] << 63),
+                                  (below[w] << 1) | (below[w - 1] >> 63), below[w], (below[w] >> 1) | (below[w + 1] << 63));
+        out[w] = next;
+        changes[w] |= next ^ cur[w];
+    }
+    if (w < word_end) {
+        store_word(out, cur, changes, w, life_word_wrapped(above, cur, below, w, words, cols), words, cols);
+    }
+}
+
+// Same as life_row, but the words that have both neighbor words inside the row are computed
+// sizeof(Vec) / 8 words at a time. Only the first and last word of a row need the wraparound.
+template <typename Vec>
+LIFE_INLINE void life_row_vectorized(const uint64_t* above, const uint64_t* cur, const uint64_t* below, uint64_t* out,
+                                     size_t word_begin, size_t word_end, size_t words, size_t cols, uint64_t* changes) {
+    const size_t lanes = sizeof(Vec) / sizeof(uint64_t);
+    size_t w = (word_begin > 0) ? word_begin : 1;
+    const size_t inner_end = (word_end < words) ? word_end : words - 1;
+    if (w + lanes > inner_end) {
+        life_row(above, cur, below, out, word_begin, word_end, words, cols, changes);
+        return;
+    }
+
+    life_row(above, cur, below, out, word_begin, w, words, cols, changes);
+    for (; w + lanes <= inner_end; w += lanes) {
+        Vec a, a_p, a_n, c, c_p, c_n, b, b_p, b_n, changed;
+        memcpy(&a, above + w, sizeof(Vec)); memcpy(&a_p, above + w - 1, sizeof(Vec)); memcpy(&a_n, above + w + 1, sizeof(Vec));
+        memcpy(&c, cur + w, sizeof(Vec));   memcpy(&c_p, cur + w - 1, sizeof(Vec));   memcpy(&c_n, cur + w + 1, sizeof(Vec));
+        memcpy(&b, below + w, sizeof(Vec)); memcpy(&b_p, below + w - 1, sizeof(Vec)); memcpy(&b_n, below + w + 1, sizeof(Vec));
+        Vec a_w = (a << 1) | (a_p >> 63), a_e = (a >> 1) | (a_n << 63);
+        Vec c_w = (c << 1) | (c_p >> 63), c_e = (c >> 1) | (c_n << 63);
+        Vec b_w = (b << 1) | (b_p >> 63), b_e = (b >> 1) | (b_n << 63);
+        Vec next;
+        next_generation<Vec>(a_w, a, a_e, c_w, c, c_e, b_w, b, b_e, next);
+        memcpy(out + w, &next, sizeof(Vec));
+        memcpy(&changed, changes + w, sizeof(Vec));
+        changed |= next ^ c;
+        memcpy(changes + w, &changed, sizeof(Vec));
+    }
+    life_row(above, cur, below, out, w, word_end, words, cols, changes);
+}
+
+#if LIFE_KERNELS_X86
+typedef uint64_t life_vec256 __attribute__((vector_size(32)));
+typedef uint64_t life_vec512 __attribute__((vector_size(64)));
+
+__attribute__((target("avx2")))
+inline void life_row_avx2(const uint64_t* above, const uint64_t* cur, const uint64_t* below, uint64_t* out,
+                          size_t word_begin, size_t word_end, size_t words, size_t cols, uint64_t* changes) {
+    life_row_vectorized<life_vec256>(above, cur, below, out, word_begin, word_end, words, cols, changes);
+}
+
+__attribute__((target("avx512f")))
+inline void life_row_avx512(const uint64_t* above, const uint64_t* cur, const uint64_t* below, uint64_t* out,
+                            size_t word_begin, size_t word_end, size_t words, size_t cols, uint64_t* changes) {
+    life_row_vectorized<life_vec512>(above, cur, below, out, word_begin, word_end, words, cols, changes);
+}
+#endif
+
+
+// Lookup tables for the rule, generated at compile time.
+// next_3x3: bit (3*r + c) of the index is cell (r, c) of a 3x3 neighborhood, the value is the next state of the center.
+// next_4x4: bit (4*r + c) of the index is cell (r, c) of a 4x4 block, bit (2*r + c) of the value is the next state
+//           of the center cell (r + 1, c + 1), so that one lookup advances four cells.
+struct LifeTables {
+    unsigned char next_3x3[1 << 9];
+    unsigned char next_4x4[1 << 16];
+};
+
+constexpr LifeTables make_life_tables() {
+    LifeTables tables{};
+    for (unsigned index = 0; index < (1u << 9); index++) {
+        unsigned neighbors = 0;
+        for (unsigned bit = 0; bit < 9; bit++) {
+            if (bit != 4) neighbors += (index >> bit) & 1;
+        }
+        tables.next_3x3[index] = life_rule((index >> 4) & 1, neighbors);
+    }
+    for (unsigned index = 0; index < (1u << 16); index++) {
+        unsigned char next = 0;
+        for (unsigned cell = 0; cell < 4; cell++) {
+            unsigned offset = 4 * (cell >> 1) + (cell & 1); // top left corner of the 3x3 neighborhood of the cell
+            unsigned neighborhood = ((index >> offset) & 7) | (((index >> (offset + 4)) & 7) << 3) | (((index >> (offset + 8)) & 7) << 6);
+            next |= tables.next_3x3[neighborhood] << cell;
+        }
+        tables.next_4x4[index] = next;
+    }
+    return tables;
+}
+
+inline constexpr LifeTables life_tables = make_life_tables();
+
+// n <= 4 cells of a row starting at column col (which may be -1), wrapping around the row ends
+inline unsigned row_cells(const uint64_t* row, long col, unsigned n, size_t cols) {
+    if (col >= 0 && static_cast<size_t>(col) + n <= cols) {
+        const size_t shift = col & 63, w = col >> 6;
+        uint64_t cells = row[w] >> shift;
+        if (shift + n > 64) cells |= row[w + 1] << (64 - shift);
+        return cells & ((1u << n) - 1);
+    }
+    unsigned cells = 0;
+    for (unsigned k = 0; k < n; k++) {
+        const long n_cols = cols;
+        const long c = ((col + long(k)) % n_cols + n_cols) % n_cols;
+        cells |= ((row[c >> 6] >> (c & 63)) & 1) << k;
+    }
+    return cells;
+}
+
+// Index of the 3x3 neighborhood of column col into LifeTables::next_3x3
+inline unsigned neighborhood_3x3(const uint64_t* above, const uint64_t* cur, const uint64_t* below, long col, size_t cols) {
+    return row_cells(above, col - 1, 3, cols) | (row_cells(cur, col - 1, 3, cols) << 3) | (row_cells(below, col - 1, 3, cols) << 6);
+}
+
+// Same interface as life_row, one 3x3 table lookup per cell
+inline void life_row_table(const uint64_t* above, const uint64_t* cur, const uint64_t* below, uint64_t* out,
+                           size_t word_begin, size_t word_end, size_t words, size_t cols, uint64_t* changes) {
+    for (size_t w = word_begin; w < word_end; w++) {
+        const size_t col_end = (w + 1 < words) ? (w + 1) << 6 : cols;
+        uint64_t next = 0;
+        for (size_t j = w << 6; j < col_end; j++) {
+            next |= uint64_t(life_tables.next_3x3[neighborhood_3x3(above, cur, below, j, cols)]) << (j & 63);
+        }
+        out[w] = next;
+        changes[w] |= next ^ cur[w];
+    }
+}
+
+// Computes the words [word_begin, word_end) of the two rows cur0 and cur1 with one 4x4 table lookup per 2x2 cells.
+// An odd last column falls back to the 3x3 table.
+inline void life_row_pair_table(const uint64_t* above, const uint64_t* cur0, const uint64_t* cur1, const uint64_t* below,
+                                uint64_t* out0, uint64_t* out1, size_t word_begin, size_t word_end, size_t words, size_t cols, uint64_t* changes) {
+    for (size_t w = word_begin; w < word_end; w++) {
+        const size_t col_end = (w + 1 < words) ? (w + 1) << 6 : cols;
+        uint64_t next0 = 0, next1 = 0;
+        size_t j = w << 6;
+        for (; j + 1 < col_end; j += 2) {
+            unsigned index = row_cells(above, j - 1, 4, cols) | (row_cells(cur0, j - 1, 4, cols) << 4)
+                           | (row_cells(cur1, j - 1, 4, cols) << 8) | (row_cells(below, j - 1, 4, cols) << 12);
+            uint64_t next = life_tables.next_4x4[index];
+            next0 |= (next & 3) << (j & 63);
+            next1 |= (next >> 2) << (j & 63);
+        }
+        if (j < col_end) {
+            next0 |= uint64_t(life_tables.next_3x3[neighborhood_3x3(above, cur0, cur1, j, cols)]) << (j & 63);
+            next1 |= uint64_t(life_tables.next_3x3[neighborhood_3x3(cur0, cur1, below, j, cols)]) << (j & 63);
+        }
+        out0[w] = next0;
+        out1[w] = next1;
+        changes[w] |= (next0 ^ cur0[w]) | (next1 ^ cur1[w]);
+    }
+}
+
+
+// Runtime kernel selection, so that one binary runs on every node and still uses the widest SIMD unit
+// Table is not the fastest kernel, but a portable reference point for benchmarks of the others.
+enum class TickKernel { Auto, Scalar, AVX2, AVX512, Table };
+
+typedef void (*LifeRowFunction)(const uint64_t*, const uint64_t*, const uint64_t*, uint64_t*, size_t, size_t, size_t, size_t, uint64_t*);
+
+inline bool kernel_supported(TickKernel kernel) {
+    switch (kernel) {
+#if LIFE_KERNELS_X86
+        case TickKernel::AVX2: return __builtin_cpu_supports("avx2"); // cpuid, including OS support for the registers
+        case TickKernel::AVX512: return __builtin_cpu_supports("avx512f");
+#else
+        case TickKernel::AVX2:
+        case TickKernel::AVX512: return false;
+#endif
+        default: return true;
+    }
+}
+
+// Widest kernel supported by the CPU, determined once
+inline TickKernel best_kernel() {
+    static const TickKernel best = kernel_supported(TickKernel::AVX512) ? TickKernel::AVX512
+                                 : kernel_supported(TickKernel::AVX2) ? TickKernel::AVX2
+                                 : TickKernel::Scalar;
+    return best;
+}
+
+inline LifeRowFunction row_function(TickKernel kernel) {
+    if (kernel == TickKernel::Auto) kernel = best_kernel();
+    if (!kernel_supported(kernel)) {
+        throw std::invalid_argument("Tick kernel is not supported by this CPU");
+    }
+    switch (kernel) {
+#if LIFE_KERNELS_X86
+        case TickKernel::AVX2: return life_row_avx2;
+        case TickKernel::AVX512: return life_row_avx512;
+#endif
+        case TickKernel::Table: return life_row_table;
+        default: return life_row;
+    }
+}
+
+#endif
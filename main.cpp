@@ -1,20 +1,39 @@
 #include "game_of_life_mpi.hpp"
+#include <cstdlib>
 
 // some global constants
 const size_t NO_TICKS = 44;
-const size_t PROC_ROWS = 2;
-const size_t PROC_COLS = 2;
+const size_t HALO = 4; // generations between two halo exchanges
+const size_t BALANCE_INTERVAL = 16; // generations between two repartitionings by living cells
 
 const int ROOT = 0;
 
 int main(int argc, char** argv) {
-    MPI_Init(&argc, &argv);
+    // Cores per rank: with more than one, one core exchanges the halo while the others compute
+    const char* cpus_per_task = getenv("SLURM_CPUS_PER_TASK");
+    const size_t cores = cpus_per_task ? std::max(1, atoi(cpus_per_task)) : 1;
+    init_mpi_threads(&argc, &argv, cores > 1);
 
-    MPIProcess mpi_proc("../init.pgm", PROC_ROWS, PROC_COLS, ROOT);
+    // Process grid: `game_of_life [proc_rows proc_cols]`, where 0 or a missing dimension is chosen
+    // from the number of processes and the shape of the board
+    const size_t proc_rows = (argc > 1) ? std::max(0, atoi(argv[1])) : 0;
+    const size_t proc_cols = (argc > 2) ? std::max(0, atoi(argv[2])) : 0;
+
+    MPIProcess mpi_proc("../init.pgm", proc_rows, proc_cols, ROOT);
+    mpi_proc.set_halo(HALO);
+    mpi_proc.set_balance_interval(BALANCE_INTERVAL);
+    // HALO_BACKEND=rma exchanges the halo with one-sided puts, HALO_BACKEND=shared through shared
+    // memory between the ranks of a node, to compare with send and receive
+    const char* backend = getenv("HALO_BACKEND");
+    if (backend && std::string(backend) == "rma") mpi_proc.set_halo_backend(HaloBackend::RMA);
+    if (backend && std::string(backend) == "shared") mpi_proc.set_halo_backend(HaloBackend::Shared);
+    if (cores > 1) {
+        mpi_proc.set_threads(cores - 1);
+        mpi_proc.set_comm_thread(true);
+    }
 
     for (size_t i = 0; i < NO_TICKS; i++) {
-        mpi_proc.exchange();
-        mpi_proc.tick();
+        mpi_proc.step();
     }
 
     mpi_proc.to_pgm("result.pgm");
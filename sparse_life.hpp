@@ -0,0 +1,255 @@
+#ifndef SPARSE_LIFE_HPP
+#define SPARSE_LIFE_HPP
+
+#include "game_of_life.hpp"
+#include <unordered_map>
+#include <unordered_set>
+
+// Unbounded plane stored as a hash map of 64x64 tiles. Tiles are allocated when cells next to them
+// come alive, and freed when all their cells die, so memory and tick time follow the living cells
+// instead of the size of a torus large enough to hold the pattern.
+class SparseLife {
+    static const int64_t TILE = 64;
+
+    struct Tile {
+        uint64_t rows[TILE]; // bit j of rows[i] is cell (i, j) of the tile, as in a Grid row
+    };
+
+    // Tile coordinates are kept in full, so the plane is as wide as an int64_t
+    struct TileKey {
+        int64_t row, col;
+        bool operator==(const TileKey& other) const { return row == other.row && col == other.col; }
+    };
+
+    struct TileKeyHash {
+        size_t operator()(const TileKey& key) const {
+            uint64_t h = uint64_t(key.row) * 0x9e3779b97f4a7c15ull;
+            h = (h ^ uint64_t(key.col)) * 0xff51afd7ed558ccdull;
+            return h ^ (h >> 32);
+        }
+    };
+
+    std::unordered_map<TileKey, Tile, TileKeyHash> tiles, next_tiles;
+
+    static int64_t _tile_of(int64_t x) {
+        return (x >= 0) ? x / TILE : -((-x - 1) / TILE) - 1;
+    }
+
+    static TileKey _key(int64_t tile_row, int64_t tile_col) {
+        return {tile_row, tile_col};
+    }
+
+    static int64_t _tile_row(const TileKey& key) { return key.row; }
+    static int64_t _tile_col(const TileKey& key) { return key.col; }
+
+    const Tile* _find(int64_t tile_row, int64_t tile_col) const {
+        auto it = tiles.find(_key(tile_row, tile_col));
+        return it == tiles.end() ? nullptr : &it->second;
+    }
+
+    // Computes the next generation of the tile at (tile_row, tile_col), returns false if it is empty
+    bool _tick_tile(int64_t tile_row, int64_t tile_col, Tile& next) const {
+        static const Tile empty = {};
+        const Tile* neighbors[3][3];
+        for (int dr = -1; dr <= 1; dr++) for (int dc = -1; dc <= 1; dc++) {
+            const Tile* tile = _find(tile_row + dr, tile_col + dc);
+            neighbors[dr + 1][dc + 1] = tile ? tile : &empty;
+        }
+
+        // the columns of tiles to the west, in the middle and to the east, with one row of the tiles above and below
+        uint64_t west[TILE + 2], mid[TILE + 2], east[TILE + 2];
+        uint64_t* columns[3] = {west, mid, east};
+        for (int c = 0; c < 3; c++) {
+            columns[c][0] = neighbors[0][c]->rows[TILE - 1];
+            memcpy(columns[c] + 1, neighbors[1][c]->rows, sizeof(Tile));
+            columns[c][TILE + 1] = neighbors[2][c]->rows[0];
+        }
+
+        uint64_t alive = 0;
+        for (int64_t i = 0; i < TILE; i++) {
+            uint64_t shifted_w[3], shifted_e[3];
+            for (int r = 0; r < 3; r++) {
+                shifted_w[r] = (mid[i + r] << 1) | (west[i + r] >> 63);
+                shifted_e[r] = (mid[i + r] >> 1) | (east[i + r] << 63);
+            }
+            next.rows[i] = life_word(shifted_w[0], mid[i], shifted_e[0],
+                                     shifted_w[1], mid[i + 1], shifted_e[1],
+                                     shifted_w[2], mid[i + 2], shifted_e[2]);
+            alive |= next.rows[i];
+        }
+        return alive != 0;
+    }
+
+public:
+    SparseLife() {}
+
+    // Imports the game with cell (i, j) of the game at (i, j) of the plane
+    explicit SparseLife(const GameOfLife& game) {
+        for (size_t i = 0; i < game.get_rows(); i++) {
+            const uint64_t* row = game.row_data(i);
+            for (size_t w = 0; w < Grid::words_per_row(game.get_cols()); w++) {
+                for (uint64_t bits = row[w]; bits != 0; bits &= bits - 1) {
+                    set(i, (w << 6) + __builtin_ctzll(bits), true);
+                }
+            }
+        }
+    }
+
+    bool get(int64_t row, int64_t col) const {
+        const int64_t tile_row = _tile_of(row), tile_col = _tile_of(col);
+        const Tile* tile = _find(tile_row, tile_col);
+        if (!tile) return false;
+        return (tile->rows[row - tile_row * TILE] >> (col - tile_col * TILE)) & 1;
+    }
+
+    void set(int64_t row, int64_t col, bool val) {
+        const int64_t tile_row = _tile_of(row), tile_col = _tile_of(col);
+        const uint64_t bit = uint64_t(1) << (col - tile_col * TILE);
+        if (val) {
+            auto it = tiles.find(_key(tile_row, tile_col));
+            if (it == tiles.end()) it = tiles.emplace(_key(tile_row, tile_col), Tile()).first;
+            it->second.rows[row - tile_row * TILE] |= bit;
+        } else {
+            auto it = tiles.find(_key(tile_row, tile_col));
+            if (it != tiles.end()) it->second.rows[row - tile_row * TILE] &= ~bit;
+        }
+    }
+
+    void init(std::initializer_list<std::initializer_list<int64_t>>&& l) {
+        for (auto& pair : l) {
+            set(*pair.begin(), *(pair.begin() + 1), true);
+        }
+    }
+
+    void tick() {
+        // every tile, plus the missing neighbors next to living border cells
+        std::unordered_set<TileKey, TileKeyHash> candidates;
+        for (auto& entry : tiles) {
+            const int64_t tile_row = _tile_row(entry.first), tile_col = _tile_col(entry.first);
+            const Tile& tile = entry.second;
+            candidates.insert(entry.first);
+
+            uint64_t west = 0, east = 0;
+            for (int64_t i = 0; i < TILE; i++) {
+                west |= tile.rows[i] & 1;
+                east |= tile.rows[i] >> 63;
+            }
+            const uint64_t top = tile.rows[0], bottom = tile.rows[TILE - 1];
+            if (top) candidates.insert(_key(tile_row - 1, tile_col));
+            if (bottom) candidates.insert(_key(tile_row + 1, tile_col));
+            if (west) candidates.insert(_key(tile_row, tile_col - 1));
+            if (east) candidates.insert(_key(tile_row, tile_col + 1));
+            if (top & 1) candidates.insert(_key(tile_row - 1, tile_col - 1));
+            if (top >> 63) candidates.insert(_key(tile_row - 1, tile_col + 1));
+            if (bottom & 1) candidates.insert(_key(tile_row + 1, tile_col - 1));
+            if (bottom >> 63) candidates.insert(_key(tile_row + 1, tile_col + 1));
+        }
+
+        next_tiles.clear();
+        Tile next;
+        for (const TileKey& key : candidates) {
+            if (_tick_tile(_tile_row(key), _tile_col(key), next)) {
+                next_tiles.emplace(key, next);
+            }
+        }
+        std::swap(tiles, next_tiles);
+    }
+
+    uint64_t population() const {
+        uint64_t count = 0;
+        for (auto& entry : tiles) {
+            for (int64_t i = 0; i < TILE; i++) count += __builtin_popcountll(entry.second.rows[i]);
+        }
+        return count;
+    }
+
+    size_t tile_count() const { return tiles.size(); }
+
+    // Smallest rectangle containing all living cells, false if there are none
+    bool bounding_box(int64_t& start_row, int64_t& start_col, int64_t& end_row, int64_t& end_col) const {
+        bool found = false;
+        for (auto& entry : tiles) {
+            const int64_t row0 = _tile_row(entry.first) * TILE, col0 = _tile_col(entry.first) * TILE;
+            for (int64_t i = 0; i < TILE; i++) {
+                const uint64_t bits = entry.second.rows[i];
+                if (!bits) continue;
+                const int64_t first = col0 + __builtin_ctzll(bits), last = col0 + 63 - __builtin_clzll(bits);
+                if (!found) {
+                    start_row = end_row = row0 + i;
+                    start_col = first;
+                    end_col = last;
+                    found = true;
+                }
+                start_row = std::min(start_row, row0 + i);
+                end_row = std::max(end_row, row0 + i);
+                start_col = std::min(start_col, first);
+                end_col = std::max(end_col, last);
+            }
+        }
+        if (found) {
+            end_row++; // exclusive, like the subgame coordinates
+            end_col++;
+        }
+        return found;
+    }
+
+    // Exports the window of the plane starting at (start_row, start_col)
+    GameOfLife to_game(int64_t start_row, int64_t start_col, size_t rows, size_t cols) const {
+        GameOfLife game(rows, cols);
+        for (auto& entry : tiles) {
+            const int64_t row0 = _tile_row(entry.first) * TILE, col0 = _tile_col(entry.first) * TILE;
+            for (int64_t i = 0; i < TILE; i++) {
+                const int64_t row = row0 + i - start_row;
+                if (row < 0 || row >= static_cast<int64_t>(rows)) continue;
+                for (uint64_t bits = entry.second.rows[i]; bits != 0; bits &= bits - 1) {
+                    const int64_t col = col0 + __builtin_ctzll(bits) - start_col;
+                    if (col >= 0 && col < static_cast<int64_t>(cols)) game.set(row, col, true);
+                }
+            }
+        }
+        return game;
+    }
+
+    void to_pgm(const std::string&, int64_t start_row, int64_t start_col, size_t rows, size_t cols) const;
+
+    // Writes the bounding box of the living cells
+    void to_pgm(const std::string& filename) const {
+        int64_t start_row = 0, start_col = 0, end_row = 1, end_col = 1;
+        bounding_box(start_row, start_col, end_row, end_col);
+        to_pgm(filename, start_row, start_col, end_row - start_row, end_col - start_col);
+    }
+};
+
+
+void SparseLife::to_pgm(const std::string& filename, int64_t start_row, int64_t start_col, size_t rows, size_t cols) const {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::ios_base::failure("Failed to open file");
+    }
+
+    // Write PGM header
+    file << "P5\n";
+    file << cols << " " << rows << "\n";
+    file << "1\n";
+
+    // Write pixel data row by row, looking up each tile once per row
+    std::vector<unsigned char> line(cols);
+    for (size_t i = 0; i < rows; i++) {
+        std::fill(line.begin(), line.end(), 0);
+        const int64_t row = start_row + i;
+        const int64_t tile_row = _tile_of(row);
+        for (int64_t tile_col = _tile_of(start_col); tile_col * TILE < start_col + static_cast<int64_t>(cols); tile_col++) {
+            const Tile* tile = _find(tile_row, tile_col);
+            if (!tile) continue;
+            for (uint64_t bits = tile->rows[row - tile_row * TILE]; bits != 0; bits &= bits - 1) {
+                const int64_t col = tile_col * TILE + __builtin_ctzll(bits) - start_col;
+                if (col >= 0 && col < static_cast<int64_t>(cols)) line[col] = 1;
+            }
+        }
+        file.write(reinterpret_cast<const char*>(line.data()), cols);
+    }
+
+    file.close();
+}
+
+#endif
@@ -6,13 +6,14 @@
 #SBATCH --nodes=1
 #SBATCH --ntasks=4
 #SBATCH --time=0:30:00
-#SBATCH --cpus-per-task=1
+#SBATCH --cpus-per-task=16 # one rank per NUMA domain, ticking with a thread team
 #SBATCH --exclusive
 
 # compile with version 4.1.1
 module load mpi/openmpi/4.1.1
-mpicxx main.cpp -o game_of_life
+mpicxx -O2 -pthread main.cpp -o game_of_life
 
 # change the MPI version, because Draco is not set up correctly.
 module load mpi/openmpi/4.1.0
-mpirun -np 4 game_of_life
+# the process grid follows --ntasks, pass proc_rows and proc_cols to game_of_life to force one
+mpirun -np $SLURM_NTASKS --map-by slot:PE=$SLURM_CPUS_PER_TASK game_of_life
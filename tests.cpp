@@ -1,6 +1,8 @@
 #define CATCH_CONFIG_MAIN
 #include "catch.hpp"
 #include "game_of_life.hpp" // Assume the GameOfLife implementation is in this header file
+#include "hashlife.hpp"
+#include "sparse_life.hpp"
 
 TEST_CASE("Grid basic operations") {
     Grid grid(5, 5);
@@ -31,6 +33,18 @@ TEST_CASE("Grid basic operations") {
         REQUIRE(grid.no_neighbors(1, 1) == 2);
         REQUIRE(grid.no_neighbors(2, 2) == 3);
     }
+
+    SECTION("Count neighbors across the edges") {
+        grid.set(0, 0, true);
+        grid.set(4, 4, true);
+        grid.set(0, 4, true);
+        grid.set(2, 2, true);
+
+        REQUIRE(grid.no_neighbors(4, 0) == 3);
+        REQUIRE(grid.no_neighbors(0, 0) == 2);
+        REQUIRE(grid.no_neighbors(1, 1) == 2);
+        REQUIRE(grid.no_neighbors(-1, -1) == 2); // same cell as (4, 4)
+    }
 }
 
 TEST_CASE("Game of Life rules") {
@@ -91,4 +105,473 @@ TEST_CASE("Game of Life rules") {
         REQUIRE(game.get(4, 4) == true); // Wraps around diagonally
         REQUIRE(game.get(0, 0) == false); // Dies of overpopulation
     }
-}
\ No newline at end of file
+}
+
+// Reference generation computed cell by cell with Grid::no_neighbors
+GameOfLife reference_tick(const GameOfLife& game) {
+    GameOfLife next(game.get_rows(), game.get_cols());
+    for (size_t i = 0; i < game.get_rows(); i++) {
+        for (size_t j = 0; j < game.get_cols(); j++) {
+            next.set(i, j, game.becomes_alive(i, j));
+        }
+    }
+    return next;
+}
+
+bool same_state(const GameOfLife& a, const GameOfLife& b) {
+    if (a.get_rows() != b.get_rows() || a.get_cols() != b.get_cols()) return false;
+    for (size_t i = 0; i < a.get_rows(); i++) {
+        for (size_t j = 0; j < a.get_cols(); j++) {
+            if (a.get(i, j) != b.get(i, j)) return false;
+        }
+    }
+    return true;
+}
+
+void randomize(GameOfLife& game, unsigned seed) {
+    srand(seed);
+    for (size_t i = 0; i < game.get_rows(); i++) {
+        for (size_t j = 0; j < game.get_cols(); j++) {
+            game.set(i, j, rand() % 3 == 0);
+        }
+    }
+}
+
+TEST_CASE("Bitboard tick matches the cell by cell rule") {
+    const std::vector<std::pair<size_t, size_t>> sizes({{1, 1}, {2, 3}, {5, 64}, {7, 65}, {64, 63}, {33, 130}, {70, 200}});
+    for (auto& size : sizes) {
+        GameOfLife game(size.first, size.second);
+        randomize(game, size.first * 1000 + size.second);
+        for (int t = 0; t < 8; t++) {
+            GameOfLife expected = reference_tick(game);
+            game.tick();
+            REQUIRE(same_state(game, expected));
+        }
+    }
+}
+
+TEST_CASE("SIMD kernels match the scalar kernel") {
+    for (TickKernel kernel : {TickKernel::Scalar, TickKernel::AVX2, TickKernel::AVX512}) {
+        if (!kernel_supported(kernel)) continue;
+        for (size_t cols : {64, 100, 320, 575, 1024}) {
+            GameOfLife game(20, cols);
+            randomize(game, cols);
+            GameOfLife scalar = game;
+            game.set_kernel(kernel);
+            scalar.set_kernel(TickKernel::Scalar);
+            for (int t = 0; t < 10; t++) {
+                game.tick();
+                scalar.tick();
+                REQUIRE(same_state(game, scalar));
+            }
+        }
+    }
+}
+
+TEST_CASE("Lookup table kernel matches the bitwise kernel") {
+    // a blinker through the middle of the 3x3 and 4x4 tables
+    REQUIRE(life_tables.next_3x3[0b000111000] == 1);
+    REQUIRE(life_tables.next_3x3[0b000010000] == 0);
+    REQUIRE(life_tables.next_4x4[0b0000011100000000] == 0b0101); // the blinker turns vertical in column 1
+
+    const std::vector<std::pair<size_t, size_t>> sizes({{1, 1}, {3, 5}, {2, 2}, {7, 65}, {10, 130}, {33, 64}});
+    for (auto& size : sizes) {
+        GameOfLife game(size.first, size.second);
+        randomize(game, size.first + size.second);
+        GameOfLife bitwise = game;
+        game.set_kernel(TickKernel::Table);
+        for (int t = 0; t < 8; t++) {
+            game.tick();
+            bitwise.tick();
+            REQUIRE(same_state(game, bitwise));
+        }
+    }
+}
+
+TEST_CASE("Active tiles skip unchanged regions") {
+    SECTION("Only the tiles around an oscillator are computed") {
+        GameOfLife game(256, 256);
+        game.init({{100, 99}, {100, 100}, {100, 101}}); // blinker in tile (1, 1)
+        for (int t = 0; t < 4; t++) game.tick();
+        REQUIRE(game.get_tile_count() == 16);
+        REQUIRE(game.get_skipped_tiles() == 7);
+        REQUIRE(game.get(99, 100) == false);
+        REQUIRE(game.get(100, 99) == true);
+    }
+
+    SECTION("Tracking gives the same result as computing every tile") {
+        for (TickKernel kernel : {TickKernel::Auto, TickKernel::Table}) {
+            GameOfLife game(150, 300);
+            GameOfLife soup(30, 40);
+            randomize(soup, 11);
+            for (size_t i = 0; i < 30; i++) for (size_t j = 0; j < 40; j++) game.set(60 + i, 130 + j, soup.get(i, j));
+            game.init({{0, 1}, {1, 2}, {2, 0}, {2, 1}, {2, 2}}); // glider crossing the tile borders and the torus edges
+            game.set_kernel(kernel);
+            GameOfLife full = game;
+            full.set_active_tracking(false);
+            for (int t = 0; t < 60; t++) {
+                if (t == 30) {
+                    game.set(5, 200, true);
+                    full.set(5, 200, true);
+                }
+                game.tick();
+                full.tick();
+                REQUIRE(same_state(game, full));
+            }
+            REQUIRE(full.get_skipped_tiles() == 0);
+        }
+    }
+}
+
+TEST_CASE("Threaded tick matches the serial tick") {
+    for (size_t threads : {2, 3, 4, 8}) {
+        GameOfLife game(330, 200); // 6 tile rows, the last one partial
+        randomize(game, threads);
+        game.init({{320, 1}, {321, 2}, {322, 0}, {322, 1}, {322, 2}}); // glider crossing the bottom edge
+        GameOfLife serial = game;
+        game.set_threads(threads);
+        REQUIRE(game.get_threads() == threads);
+        REQUIRE(serial.get_threads() == 1);
+        for (int t = 0; t < 30; t++) {
+            game.tick();
+            serial.tick();
+            REQUIRE(same_state(game, serial));
+            REQUIRE(game.get_skipped_tiles() == serial.get_skipped_tiles());
+        }
+        GameOfLife copy = game;
+        REQUIRE(copy.get_threads() == threads);
+        copy.tick();
+        serial.tick();
+        REQUIRE(same_state(copy, serial));
+    }
+}
+
+TEST_CASE("HashLife matches GameOfLife away from the torus edges") {
+    GameOfLife game(160, 200);
+    GameOfLife soup(24, 24);
+    randomize(soup, 7);
+    for (size_t i = 0; i < 24; i++) for (size_t j = 0; j < 24; j++) game.set(64 + i, 80 + j, soup.get(i, j));
+    game.init({{10, 11}, {11, 12}, {12, 10}, {12, 11}, {12, 12}}); // glider
+
+    HashLife hashlife(game);
+    REQUIRE(same_state(hashlife.to_game(0, 0, 160, 200), game));
+
+    SECTION("Single generations") {
+        for (int t = 0; t < 5; t++) {
+            hashlife.step(0);
+            game.tick();
+        }
+        REQUIRE(hashlife.get_generation() == 5);
+        REQUIRE(same_state(hashlife.to_game(0, 0, 160, 200), game));
+    }
+
+    SECTION("Power of two steps") {
+        hashlife.step(5);
+        hashlife.step(3);
+        for (int t = 0; t < 40; t++) game.tick();
+        REQUIRE(hashlife.get_generation() == 40);
+        REQUIRE(same_state(hashlife.to_game(0, 0, 160, 200), game));
+    }
+
+    SECTION("Steps of mixed sizes") {
+        hashlife.advance(37); // steps of 1, 4 and 32 generations, each with its own memoized results
+        hashlife.advance(11);
+        hashlife.step(2);
+        for (int t = 0; t < 52; t++) game.tick();
+        REQUIRE(hashlife.get_generation() == 52);
+        REQUIRE(same_state(hashlife.to_game(0, 0, 160, 200), game));
+    }
+
+    SECTION("Macrocell round trip") {
+        hashlife.step(4);
+        hashlife.to_macrocell("hashlife_test.mc");
+        HashLife loaded;
+        loaded.initialize_from_macrocell("hashlife_test.mc");
+        REQUIRE(loaded.get_generation() == 16);
+        REQUIRE(loaded.population() == hashlife.population());
+        REQUIRE(same_state(loaded.to_game(-20, -20, 200, 240), hashlife.to_game(-20, -20, 200, 240)));
+
+        // a block around the origin, whose root shrinks when it is advanced
+        HashLife block;
+        for (int64_t i = -1; i <= 0; i++) for (int64_t j = -1; j <= 0; j++) block.set(i, j, true);
+        block.step(0);
+        block.to_macrocell("hashlife_test.mc");
+        loaded.initialize_from_macrocell("hashlife_test.mc");
+        REQUIRE(loaded.population() == 4);
+        REQUIRE(same_state(loaded.to_game(-4, -4, 8, 8), block.to_game(-4, -4, 8, 8)));
+        REQUIRE(block.to_game(-4, -4, 8, 8).get(3, 3));
+    }
+}
+
+TEST_CASE("HashLife advances a glider far across the plane") {
+    HashLife hashlife;
+    for (auto& cell : std::vector<std::pair<int, int>>({{0, 1}, {1, 2}, {2, 0}, {2, 1}, {2, 2}})) {
+        hashlife.set(cell.first, cell.second, true);
+    }
+    hashlife.step(20); // the glider moves one cell diagonally every 4 generations
+    size_t nodes = hashlife.node_count();
+    hashlife.collect_garbage();
+    REQUIRE(hashlife.node_count() < nodes);
+    REQUIRE(hashlife.population() == 5);
+    const int64_t d = (1 << 20) / 4;
+    REQUIRE(hashlife.get(d + 0, d + 1));
+    REQUIRE(hashlife.get(d + 1, d + 2));
+    REQUIRE(hashlife.get(d + 2, d + 0));
+    REQUIRE(hashlife.get(d + 2, d + 2));
+    REQUIRE(hashlife.get(d + 2, d + 1));
+}
+
+TEST_CASE("Sparse universe grows and frees tiles") {
+    GameOfLife game(192, 256);
+    GameOfLife soup(24, 24);
+    randomize(soup, 11);
+    for (size_t i = 0; i < 24; i++) for (size_t j = 0; j < 24; j++) game.set(52 + i, 116 + j, soup.get(i, j)); // across tile borders
+    game.init({{10, 11}, {11, 12}, {12, 10}, {12, 11}, {12, 12}}); // glider
+
+    SparseLife sparse(game);
+    REQUIRE(same_state(sparse.to_game(0, 0, 192, 256), game));
+    for (int t = 0; t < 40; t++) {
+        sparse.tick();
+        game.tick();
+    }
+    REQUIRE(same_state(sparse.to_game(0, 0, 192, 256), game));
+
+    SECTION("Negative coordinates") {
+        SparseLife gliders;
+        for (auto& cell : std::vector<std::pair<int, int>>({{0, 1}, {1, 2}, {2, 0}, {2, 1}, {2, 2}})) {
+            gliders.set(cell.first, cell.second, true); // moving south-east
+            gliders.set(-10 - cell.first, -10 - cell.second, true); // rotated by 180 degrees, moving north-west
+        }
+        for (int t = 0; t < 400; t++) gliders.tick(); // 100 cells diagonally
+        REQUIRE(gliders.population() == 10);
+        REQUIRE(gliders.tile_count() <= 8);
+        int64_t start_row, start_col, end_row, end_col;
+        REQUIRE(gliders.bounding_box(start_row, start_col, end_row, end_col));
+        REQUIRE(start_row == -112);
+        REQUIRE(start_col == -112);
+        REQUIRE(end_row == 103);
+        REQUIRE(end_col == 103);
+    }
+
+    SECTION("Far coordinates do not alias") {
+        SparseLife far;
+        const int64_t offset = int64_t(1) << 38; // tile 2^32, which a 32-bit tile coordinate wraps to 0
+        far.init({{0, 0}, {0, 1}, {1, 0}, {1, 1}, {offset, offset}});
+        REQUIRE(far.tile_count() == 2);
+        REQUIRE(!far.get(offset + 1, offset + 1));
+        REQUIRE(far.get(offset, offset));
+        far.tick(); // the block stays, the single cell dies
+        REQUIRE(far.population() == 4);
+        REQUIRE(!far.get(offset, offset));
+    }
+
+    SECTION("Dead tiles are freed") {
+        SparseLife single;
+        single.init({{63, 63}, {64, 64}}); // two cells in two tiles, both die
+        REQUIRE(single.tile_count() == 2);
+        single.tick();
+        REQUIRE(single.population() == 0);
+        REQUIRE(single.tile_count() == 0);
+    }
+
+    SECTION("PGM export of a window") {
+        sparse.to_pgm("sparse_test.pgm", 0, 0, 192, 256);
+        GameOfLife loaded(1, 1);
+        loaded.initialize_from_pgm("sparse_test.pgm");
+        REQUIRE(same_state(loaded, game));
+    }
+}
+
+TEST_CASE("Bits expand to bytes at any offset") {
+    uint64_t words[4];
+    srand(21);
+    for (auto& word : words) word = (uint64_t(rand()) << 33) ^ (uint64_t(rand()) << 11) ^ rand();
+    unsigned char bytes[256];
+    for (size_t start : {0, 1, 7, 57, 63, 64, 100}) {
+        for (size_t count : {0, 5, 8, 64, 71, 150}) {
+            if (start + count > 256) continue;
+            expand_bits(bytes, words, start, count);
+            bool same = true;
+            for (size_t i = 0; i < count; i++) {
+                same = same && bytes[i] == ((words[(start + i) >> 6] >> ((start + i) & 63)) & 1);
+            }
+            REQUIRE(same);
+        }
+    }
+}
+
+TEST_CASE("Bytes pack to bits at any offset") {
+    unsigned char bytes[200];
+    srand(22);
+    for (auto& byte : bytes) byte = (rand() % 3 == 0) ? ((rand() % 2) ? 1 : 0x80 | rand()) : 0;
+    for (size_t start : {0, 1, 7, 57, 63, 64, 100}) {
+        for (size_t count : {0, 5, 8, 64, 71, 150}) {
+            uint64_t words[6] = {~uint64_t(0), 0, ~uint64_t(0), 0, ~uint64_t(0), 0};
+            const uint64_t before[6] = {words[0], words[1], words[2], words[3], words[4], words[5]};
+            pack_bytes(words, start, bytes, count);
+            bool same = true;
+            for (size_t bit = 0; bit < 384; bit++) {
+                const bool expected = (bit >= start && bit < start + count) ? bytes[bit - start] != 0
+                                                                           : (before[bit >> 6] >> (bit & 63)) & 1;
+                same = same && bool((words[bit >> 6] >> (bit & 63)) & 1) == expected;
+            }
+            REQUIRE(same);
+        }
+    }
+}
+
+TEST_CASE("PBM files hold eight cells per byte") {
+    GameOfLife game(5, 10);
+    game.init({{0, 0}, {0, 9}, {2, 7}, {4, 8}});
+    game.to_pbm("pbm_test.pbm");
+
+    std::ifstream file("pbm_test.pbm", std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    const std::string header = "P4\n10 5\n";
+    REQUIRE(contents.size() == header.size() + 5 * 2);
+    REQUIRE(contents.substr(0, header.size()) == header);
+    REQUIRE((unsigned char)contents[header.size()] == 0x80);     // first pixel in the top bit
+    REQUIRE((unsigned char)contents[header.size() + 1] == 0x40);
+    REQUIRE((unsigned char)contents[header.size() + 4] == 0x01);
+
+    for (auto& size : std::vector<std::pair<size_t, size_t>>{{5, 10}, {33, 64}, {17, 131}}) {
+        GameOfLife random(size.first, size.second);
+        randomize(random, size.first * size.second);
+        random.to_pbm("pbm_test.pbm");
+        GameOfLife loaded(1, 1);
+        loaded.initialize_from_pbm("pbm_test.pbm");
+        REQUIRE(same_state(loaded, random));
+        random.to_pgm("pgm_test.pgm");
+        GameOfLife loaded_pgm(1, 1);
+        loaded_pgm.initialize_from_pgm("pgm_test.pgm");
+        REQUIRE(same_state(loaded_pgm, random));
+    }
+    REQUIRE_THROWS_AS(GameOfLife(1, 1).initialize_from_pbm("pgm_test.pgm"), std::invalid_argument);
+
+    // a failed load leaves the board as it was
+    for (const char* truncated : {"P4 100 100\n\x80", "P4 8 18446744073709551615\n", "P4 18446744073709551615 2\n"}) {
+        {
+            std::ofstream file("pbm_test.pbm", std::ios::binary);
+            file << truncated;
+        }
+        GameOfLife kept = game;
+        REQUIRE_THROWS_AS(kept.initialize_from_pbm("pbm_test.pbm"), std::ios_base::failure);
+        REQUIRE((kept.get_rows() == 5 && kept.get_cols() == 10));
+        kept.tick();
+        REQUIRE(same_state(kept, reference_tick(game)));
+    }
+}
+
+TEST_CASE("RLE patterns are read and written run by run") {
+    {
+        std::ofstream file("rle_test.rle");
+        file << "#N Glider\n#C a comment\nx = 5, y = 6, rule = B3/S23\nbo$2bo$3o2$\n5o!\n";
+    }
+    GameOfLife game(1, 1);
+    game.initialize_from_rle("rle_test.rle");
+    GameOfLife expected(6, 5);
+    expected.init({{0, 1}, {1, 2}, {2, 0}, {2, 1}, {2, 2}, {4, 0}, {4, 1}, {4, 2}, {4, 3}, {4, 4}});
+    REQUIRE(same_state(game, expected));
+
+    game.to_rle("rle_test.rle");
+    std::ifstream file("rle_test.rle");
+    std::string header, runs;
+    std::getline(file, header);
+    std::getline(file, runs);
+    REQUIRE(header == "x = 5, y = 6, rule = B3/S23");
+    REQUIRE(runs == "bo$2bo$3o2$5o!");
+
+    // long runs across words, empty rows at the start and end, long lines
+    GameOfLife sparse(300, 200);
+    srand(24);
+    for (size_t i = 3; i < 290; i += 1 + rand() % 20) {
+        for (size_t j = rand() % 50; j < 200; j += 1 + rand() % 40) {
+            for (size_t k = rand() % 90; k > 0 && j < 200; k--, j++) sparse.set(i, j, true);
+        }
+    }
+    sparse.to_rle("rle_test.rle");
+    GameOfLife loaded(1, 1);
+    loaded.initialize_from_rle("rle_test.rle");
+    REQUIRE(same_state(loaded, sparse));
+    std::ifstream written("rle_test.rle");
+    for (std::string line; std::getline(written, line);) REQUIRE(line.size() <= 70);
+
+    // the terminator wraps like any other item: this body is exactly 70 characters before it
+    GameOfLife full_line(2, 70);
+    full_line.set(0, 0, true);
+    for (size_t j = 1; j < 68; j += 2) full_line.set(1, j, true);
+    full_line.to_rle("rle_test.rle");
+    std::ifstream wrapped("rle_test.rle");
+    std::getline(wrapped, header);
+    std::getline(wrapped, runs);
+    REQUIRE(runs.size() == 70);
+    std::getline(wrapped, runs);
+    REQUIRE(runs == "!");
+    loaded.initialize_from_rle("rle_test.rle");
+    REQUIRE(same_state(loaded, full_line));
+
+    {
+        std::ofstream other_rule("rle_test.rle");
+        other_rule << "x = 2, y = 2, rule = B36/S23\n2o$2o!\n";
+    }
+    REQUIRE_THROWS_AS(loaded.initialize_from_rle("rle_test.rle"), std::invalid_argument);
+
+    // a failed load leaves the board as it was
+    for (const char* invalid : {"x = 3, y = 2\nobo$4o!\n", "x = 3, y = 2\nobo$2x!\n",
+                                "x = 3, y = 2\n18446744073709551617o!\n", "x = 3, y = 2\no$o$o!\n"}) {
+        {
+            std::ofstream file("rle_test.rle");
+            file << invalid;
+        }
+        GameOfLife kept = game;
+        REQUIRE_THROWS_AS(kept.initialize_from_rle("rle_test.rle"), std::invalid_argument);
+        REQUIRE(same_state(kept, game));
+        kept.tick();
+        REQUIRE(same_state(kept, reference_tick(game)));
+    }
+}
+
+TEST_CASE("Mapped PGM and PBM headers are parsed in place") {
+    GameOfLife expected(2, 9);
+    expected.init({{0, 0}, {0, 8}, {1, 3}});
+    {
+        std::ofstream file("mapped_test.pgm", std::ios::binary);
+        file << "P5\n# a comment\n9 # another\n2\n1\n";
+        const unsigned char pixels[18] = {1, 0, 0, 0, 0, 0, 0, 0, 255, 0, 0, 0, 1, 0, 0, 0, 0, 0};
+        file.write(reinterpret_cast<const char*>(pixels), sizeof(pixels));
+    }
+    GameOfLife game(1, 1);
+    game.initialize_from_pgm("mapped_test.pgm");
+    REQUIRE(same_state(game, expected));
+
+    {
+        std::ofstream file("mapped_test.pbm", std::ios::binary);
+        file << "P4 9 2\n";
+        const unsigned char pixels[4] = {0x80, 0x80, 0x10, 0x00};
+        file.write(reinterpret_cast<const char*>(pixels), sizeof(pixels));
+    }
+    game.initialize_from_pbm("mapped_test.pbm");
+    REQUIRE(same_state(game, expected));
+
+    {
+        std::ofstream truncated("mapped_test.pbm", std::ios::binary);
+        truncated << "P4 9 2\n" << char(0x80);
+    }
+    REQUIRE_THROWS_AS(game.initialize_from_pbm("mapped_test.pbm"), std::ios_base::failure);
+
+    // a failed load leaves the board as it was
+    for (const char* invalid : {"P5 100 100 1\n\x01", "P5 2 9223372036854775807 1\n", "P5 9 2 255\n", "P5 99999999999999999999 1 1\n"}) {
+        {
+            std::ofstream file("mapped_test.pgm", std::ios::binary);
+            file << invalid;
+        }
+        GameOfLife kept = game;
+        REQUIRE_THROWS(kept.initialize_from_pgm("mapped_test.pgm"));
+        REQUIRE((kept.get_rows() == 2 && kept.get_cols() == 9));
+        kept.tick();
+        REQUIRE(same_state(kept, reference_tick(game)));
+    }
+    { std::ofstream empty("mapped_test.pgm", std::ios::binary); }
+    REQUIRE_THROWS_AS(game.initialize_from_pgm("mapped_test.pgm"), std::invalid_argument);
+    REQUIRE_THROWS_AS(game.initialize_from_pgm("missing_file.pgm"), std::ios_base::failure);
+}
@@ -1,10 +1,53 @@
 
 #define CATCH_CONFIG_RUNNER
+#include <atomic>
 #include "catch.hpp"
 #include "game_of_life_mpi.hpp"
 
+// Counts the allocations with new, to check that a generation does not allocate. The thread teams
+// allocate too, so the counter is atomic.
+static std::atomic<size_t> allocations(0);
+
+void* operator new(size_t size) {
+    allocations++;
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+// Not inlined, or the compiler sees memory from new released with free
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+
+// Fills the top left rows x cols of the board with living cells, one in three on average
+void randomize(GameOfLife& game, unsigned seed, size_t rows, size_t cols) {
+    srand(seed);
+    for (size_t i = 0; i < rows; i++) {
+        for (size_t j = 0; j < cols; j++) {
+            game.set(i, j, rand() % 3 == 0);
+        }
+    }
+}
+
+void randomize(GameOfLife& game, unsigned seed) {
+    randomize(game, seed, game.get_rows(), game.get_cols());
+}
+
+bool same_state(const GameOfLife& a, const GameOfLife& b) {
+    if (a.get_rows() != b.get_rows() || a.get_cols() != b.get_cols()) return false;
+    for (size_t i = 0; i < a.get_rows(); i++) {
+        for (size_t j = 0; j < a.get_cols(); j++) {
+            if (a.get(i, j) != b.get(i, j)) return false;
+        }
+    }
+    return true;
+}
+
 int main( int argc, char* argv[] ) {
-    MPI_Init(&argc, &argv);
+    init_mpi_threads(&argc, &argv, true);
     int result = Catch::Session().run( argc, argv );
     MPI_Finalize();
     return result;
@@ -98,3 +141,382 @@ TEST_CASE("Glider simulation over multiple iterations") {
         mpi_process.tick();
     }
 }
+
+TEST_CASE("Hybrid steps match the serial game") {
+    GameOfLife game(150, 300);
+    randomize(game, 5);
+
+    for (bool comm_thread : {false, true}) {
+        MPIProcess mpi_process(game, 2, 2, 0);
+        mpi_process.set_threads(3);
+        mpi_process.set_comm_thread(comm_thread);
+        REQUIRE(mpi_process.get_threads() == 3);
+        REQUIRE(mpi_process.get_comm_thread() == comm_thread);
+
+        GameOfLife expected = game;
+        for (int t = 0; t < 20; t++) {
+            mpi_process.step();
+            expected.tick();
+        }
+
+        GameOfLife result = mpi_process.gather_subgrids();
+        if (mpi_process.get_rank() == 0) {
+            REQUIRE(same_state(result, expected));
+        }
+    }
+}
+
+TEST_CASE("Overlapped step matches exchange and tick") {
+    const std::vector<std::pair<size_t, size_t>> sizes({{6, 6}, {9, 11}, {40, 140}, {130, 260}});
+    for (auto& size : sizes) {
+        GameOfLife game(size.first, size.second);
+        randomize(game, size.first + size.second);
+
+        MPIProcess stepped(game, 2, 2, 0);
+        MPIProcess blocking(game, 2, 2, 0);
+        for (int t = 0; t < 12; t++) {
+            stepped.step();
+            blocking.exchange();
+            blocking.tick();
+        }
+
+        GameOfLife result = stepped.gather_subgrids();
+        GameOfLife expected = blocking.gather_subgrids();
+        if (stepped.get_rank() == 0) {
+            REQUIRE(same_state(result, expected));
+        }
+    }
+}
+
+TEST_CASE("Deep halos exchange every k generations") {
+    GameOfLife game(70, 150);
+    randomize(game, 3);
+
+    MPIProcess mpi_process(game, 2, 2, 0);
+    REQUIRE(mpi_process.get_halo() == 1);
+    REQUIRE_THROWS_AS(mpi_process.set_halo(0), std::invalid_argument);
+    REQUIRE_THROWS_AS(mpi_process.set_halo(36), std::invalid_argument);
+
+    GameOfLife wide(150, 301); // halos wider than a word, columns split unevenly
+    randomize(wide, 4);
+
+    for (size_t halo : {2, 5, 35, 70}) {
+        if (halo == 70) game = wide;
+        for (bool comm_thread : {false, true}) {
+            MPIProcess deep(game, 2, 2, 0);
+            deep.set_halo(halo);
+            deep.set_comm_thread(comm_thread);
+            REQUIRE(deep.get_halo() == halo);
+
+            GameOfLife expected = game;
+            for (int t = 0; t < 13; t++) { // ends between two exchanges
+                deep.step();
+                expected.tick();
+            }
+
+            GameOfLife result = deep.gather_subgrids();
+            if (deep.get_rank() == 0) {
+                REQUIRE(same_state(result, expected));
+            }
+        }
+    }
+}
+
+TEST_CASE("Steps do not allocate once warmed up") {
+    GameOfLife game(100, 200);
+    randomize(game, 9);
+
+    for (bool comm_thread : {false, true}) {
+        MPIProcess mpi_process(game, 2, 2, 0);
+        mpi_process.set_threads(2);
+        mpi_process.set_halo(2);
+        mpi_process.set_comm_thread(comm_thread);
+        for (int t = 0; t < 4; t++) mpi_process.step();
+
+        const size_t before = allocations;
+        for (int t = 0; t < 10; t++) {
+            mpi_process.step();
+        }
+        mpi_process.exchange();
+        mpi_process.tick();
+        REQUIRE(allocations == before);
+    }
+}
+
+TEST_CASE("Skipped tiles are counted over the whole subgame") {
+    GameOfLife dead(512, 512);
+    for (size_t threads : {1, 2}) {
+        MPIProcess mpi_process(dead, 0, 0, 0);
+        mpi_process.set_threads(threads);
+        mpi_process.set_halo(4);
+        REQUIRE(mpi_process.get_tile_count() > 0);
+
+        mpi_process.step(); // every tile is new
+        REQUIRE(mpi_process.get_skipped_tiles() == 0);
+        for (int t = 1; t < 4; t++) { // between two exchanges nothing changes
+            mpi_process.step();
+            REQUIRE(mpi_process.get_skipped_tiles() == mpi_process.get_tile_count());
+        }
+    }
+}
+
+TEST_CASE("Process grid follows the shape of the board") {
+    size_t proc_rows = 0, proc_cols = 0;
+    choose_proc_grid(4, 100, 100, proc_rows, proc_cols);
+    REQUIRE((proc_rows == 2 && proc_cols == 2));
+    proc_rows = proc_cols = 0;
+    choose_proc_grid(4, 1000, 10, proc_rows, proc_cols);
+    REQUIRE((proc_rows == 4 && proc_cols == 1));
+    proc_rows = proc_cols = 0;
+    choose_proc_grid(6, 20, 1000, proc_rows, proc_cols);
+    REQUIRE((proc_rows == 1 && proc_cols == 6));
+    proc_rows = proc_cols = 0;
+    choose_proc_grid(12, 300, 400, proc_rows, proc_cols);
+    REQUIRE((proc_rows == 3 && proc_cols == 4));
+    proc_rows = 0, proc_cols = 2;
+    choose_proc_grid(6, 10, 10, proc_rows, proc_cols);
+    REQUIRE(proc_rows == 3);
+    proc_rows = 4, proc_cols = 0;
+    REQUIRE_THROWS_AS(choose_proc_grid(6, 10, 10, proc_rows, proc_cols), std::invalid_argument);
+    proc_rows = proc_cols = 0;
+    REQUIRE_THROWS_AS(choose_proc_grid(5, 2, 2, proc_rows, proc_cols), std::invalid_argument);
+    proc_rows = 4, proc_cols = 1; // an explicit grid must fit the board too
+    REQUIRE_THROWS_AS(choose_proc_grid(4, 2, 20, proc_rows, proc_cols), std::invalid_argument);
+    proc_rows = 0, proc_cols = 4;
+    REQUIRE_THROWS_AS(choose_proc_grid(4, 20, 3, proc_rows, proc_cols), std::invalid_argument);
+    int ranks;
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+    if (ranks > 1) REQUIRE_THROWS_AS(MPIProcess(GameOfLife(ranks - 1, 20), ranks, 1, 0), std::invalid_argument);
+
+    GameOfLife game(120, 12);
+    game.init({{2,4},{3,5},{4,3},{4,4},{4,5}});
+    MPIProcess mpi_process(game, 0, 0, 0);
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    REQUIRE(mpi_process.get_proc_rows() * mpi_process.get_proc_cols() == size_t(size));
+    REQUIRE(mpi_process.get_proc_rows() >= mpi_process.get_proc_cols());
+    for (int t = 0; t < 8; t++) {
+        mpi_process.step();
+        game.tick();
+    }
+    GameOfLife gathered = mpi_process.gather_subgrids();
+    if (mpi_process.get_rank() == 0) {
+        REQUIRE(same_state(gathered, game));
+    }
+}
+
+TEST_CASE("Remainder rows and columns are spread over the ranks") {
+    GameOfLife game(23, 135);
+    randomize(game, 16);
+
+    for (size_t proc_rows : {1, 2, 4}) {
+        MPIProcess mpi_process(game, proc_rows, 0, 0);
+        size_t sizes[2] = {mpi_process.get_subgrid_rows(), mpi_process.get_subgrid_cols()}, smallest[2], largest[2];
+        MPI_Allreduce(sizes, smallest, 2, MPI_UNSIGNED_LONG, MPI_MIN, MPI_COMM_WORLD);
+        MPI_Allreduce(sizes, largest, 2, MPI_UNSIGNED_LONG, MPI_MAX, MPI_COMM_WORLD);
+        REQUIRE(largest[0] - smallest[0] <= 1);
+        REQUIRE(largest[1] - smallest[1] <= 1);
+
+        GameOfLife expected = game;
+        for (int t = 0; t < 6; t++) {
+            mpi_process.step();
+            expected.tick();
+        }
+        GameOfLife gathered = mpi_process.gather_subgrids();
+        if (mpi_process.get_rank() == 0) {
+            REQUIRE(same_state(gathered, expected));
+        }
+    }
+}
+
+TEST_CASE("Rebalancing follows the living cells") {
+    // all the living cells in the upper left corner of the board
+    GameOfLife game(64, 200);
+    randomize(game, 17, 20, 60);
+
+    for (size_t halo : {1, 3}) {
+        MPIProcess mpi_process(game, 2, 2, 0);
+        mpi_process.set_halo(halo);
+        mpi_process.set_balance_interval(4);
+        GameOfLife expected = game;
+        for (int t = 0; t < 13; t++) {
+            mpi_process.step();
+            expected.tick();
+        }
+
+        // the split moved into the corner, and each subgrid still holds at least a halo
+        if (mpi_process.get_proc_row() == 1) REQUIRE(mpi_process.get_starting_row() < 32);
+        if (mpi_process.get_proc_col() == 1) REQUIRE(mpi_process.get_starting_col() < 100);
+        REQUIRE(mpi_process.get_subgrid_rows() >= halo);
+        REQUIRE(mpi_process.get_subgrid_cols() >= halo);
+
+        GameOfLife gathered = mpi_process.gather_subgrids();
+        if (mpi_process.get_rank() == 0) {
+            REQUIRE(same_state(gathered, expected));
+        }
+    }
+}
+
+TEST_CASE("One-sided halo exchange matches send and receive") {
+    GameOfLife game(70, 150);
+    randomize(game, 18, game.get_rows(), 100);
+
+    for (size_t proc_rows : {1, 2, 4}) {
+        for (size_t halo : {1, 3, 17}) {
+            for (bool comm_thread : {false, true}) {
+                MPIProcess one_sided(game, proc_rows, 0, 0);
+                one_sided.set_halo(halo);
+                one_sided.set_halo_backend(HaloBackend::RMA);
+                one_sided.set_comm_thread(comm_thread);
+                one_sided.set_balance_interval(5);
+                REQUIRE(one_sided.get_halo_backend() == HaloBackend::RMA);
+                GameOfLife expected = game;
+                for (int t = 0; t < 12; t++) {
+                    one_sided.step();
+                    expected.tick();
+                }
+
+                GameOfLife gathered = one_sided.gather_subgrids();
+                if (one_sided.get_rank() == 0) {
+                    REQUIRE(same_state(gathered, expected));
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("Shared memory halos match send and receive") {
+    GameOfLife game(66, 140);
+    randomize(game, 19);
+
+    for (size_t proc_rows : {1, 2, 4}) {
+        for (size_t halo : {1, 2, 16}) {
+            for (bool comm_thread : {false, true}) {
+                MPIProcess shared(game, proc_rows, 0, 0);
+                shared.set_halo(halo);
+                shared.set_halo_backend(HaloBackend::Shared);
+                shared.set_comm_thread(comm_thread);
+                shared.set_balance_interval(7);
+                GameOfLife expected = game;
+                for (int t = 0; t < 15; t++) {
+                    shared.step();
+                    expected.tick();
+                }
+
+                GameOfLife gathered = shared.gather_subgrids();
+                if (shared.get_rank() == 0) {
+                    REQUIRE(same_state(gathered, expected));
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("Gathering a rectangle of the board") {
+    GameOfLife game(45, 203);
+    randomize(game, 20);
+
+    for (size_t proc_rows : {1, 2, 4}) {
+        MPIProcess mpi_process(game, proc_rows, 0, 0);
+        const size_t rectangles[][4] = {{0, 0, 45, 203}, {3, 70, 30, 190}, {22, 101, 23, 102}, {10, 10, 10, 50}};
+        for (auto& r : rectangles) {
+            GameOfLife gathered = mpi_process.gather_subgrids(r[0], r[1], r[2], r[3]);
+            if (mpi_process.get_rank() == 0) {
+                REQUIRE(gathered.get_rows() == r[2] - r[0]);
+                REQUIRE(gathered.get_cols() == r[3] - r[1]);
+                GameOfLife expected(r[2] - r[0], r[3] - r[1]);
+                for (size_t i = r[0]; i < r[2]; i++) {
+                    for (size_t j = r[1]; j < r[3]; j++) expected.set(i - r[0], j - r[1], game.get(i, j));
+                }
+                REQUIRE(same_state(gathered, expected));
+            } else {
+                REQUIRE(gathered.get_rows() == 0);
+            }
+        }
+        REQUIRE_THROWS_AS(mpi_process.gather_subgrids(0, 0, 46, 10), std::invalid_argument);
+    }
+}
+
+TEST_CASE("Collective PGM output matches the board") {
+    GameOfLife game(37, 211);
+    randomize(game, 21);
+
+    for (size_t proc_rows : {1, 2, 4}) {
+        MPIProcess mpi_process(game, proc_rows, 0, 0);
+        if (mpi_process.get_rank() == 0) {
+            std::ofstream longer("mpi_test.pgm", std::ios::binary);
+            longer << std::string(20000, 'x');
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+        mpi_process.set_halo(3);
+        mpi_process.to_pgm("mpi_test.pgm");
+        MPI_Barrier(MPI_COMM_WORLD);
+        if (mpi_process.get_rank() == 0) {
+            std::ifstream written("mpi_test.pgm", std::ios::binary | std::ios::ate);
+            REQUIRE(size_t(written.tellg()) == std::string("P5\n211 37\n1\n").size() + 37 * 211);
+            GameOfLife loaded(1, 1);
+            loaded.initialize_from_pgm("mpi_test.pgm");
+            REQUIRE(loaded.get_rows() == game.get_rows());
+            REQUIRE(loaded.get_cols() == game.get_cols());
+            REQUIRE(same_state(loaded, game));
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+    }
+}
+
+TEST_CASE("Collective PGM input matches the file") {
+    GameOfLife game(41, 150);
+    randomize(game, 22);
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (rank == 0) game.to_pgm("mpi_input_test.pgm");
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    for (size_t proc_rows : {1, 2, 4}) {
+        MPIProcess mpi_process("mpi_input_test.pgm", proc_rows, 0, 0);
+        GameOfLife expected = game;
+        for (int t = 0; t < 3; t++) {
+            mpi_process.step();
+            expected.tick();
+        }
+        GameOfLife gathered = mpi_process.gather_subgrids();
+        if (rank == 0) {
+            REQUIRE(same_state(gathered, expected));
+        }
+    }
+}
+
+TEST_CASE("PBM files are written and read collectively") {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    const std::pair<size_t, size_t> sizes[] = {{30, 20}, {37, 203}, {12, 64}};
+    for (auto& size : sizes) {
+        GameOfLife game(size.first, size.second);
+        randomize(game, size.first + size.second);
+
+        for (size_t proc_rows : {1, 2, 4}) {
+            // subgrids of 5 columns share bytes with up to two other ranks
+            MPIProcess written(game, proc_rows, 0, 0);
+            written.set_halo(2);
+            written.to_pbm("mpi_test.pbm");
+            MPI_Barrier(MPI_COMM_WORLD);
+            if (rank == 0) {
+                // written over the larger files of the previous sizes
+                std::ostringstream header;
+                header << "P4\n" << game.get_cols() << " " << game.get_rows() << "\n";
+                std::ifstream file("mpi_test.pbm", std::ios::binary | std::ios::ate);
+                REQUIRE(size_t(file.tellg()) == header.str().size() + game.get_rows() * ((game.get_cols() + 7) / 8));
+                GameOfLife loaded(1, 1);
+                loaded.initialize_from_pbm("mpi_test.pbm");
+                REQUIRE(same_state(loaded, game));
+            }
+
+            MPIProcess read("mpi_test.pbm", 4 / proc_rows, 0, 0);
+            GameOfLife gathered = read.gather_subgrids();
+            if (rank == 0) {
+                REQUIRE(same_state(gathered, game));
+            }
+            MPI_Barrier(MPI_COMM_WORLD);
+        }
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef THREAD_TEAM_HPP
+#define THREAD_TEAM_HPP
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+// A fixed team of threads that is created once and reused for every generation. run() hands the same
+// job to all members and returns once all of them are done, which is the only synchronization point.
+class ThreadTeam {
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable start, done;
+    const void* job = nullptr;                 // the callable of the current run()
+    void (*invoke)(const void*, size_t) = nullptr; // calls it without allocating, unlike std::function
+    size_t epoch = 0, running = 0;
+    bool stopping = false;
+
+    void _work(size_t member) {
+        size_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            start.wait(lock, [&] { return stopping || epoch != seen; });
+            if (stopping) return;
+            seen = epoch;
+            lock.unlock();
+            invoke(job, member);
+            lock.lock();
+            if (--running == 0) done.notify_one();
+        }
+    }
+
+public:
+    explicit ThreadTeam(size_t size) {
+        for (size_t member = 1; member < size; member++) {
+            workers.emplace_back(&ThreadTeam::_work, this, member);
+        }
+    }
+
+    ThreadTeam(const ThreadTeam&) = delete;
+    ThreadTeam& operator=(const ThreadTeam&) = delete;
+
+    ~ThreadTeam() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        start.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    size_t size() const { return workers.size() + 1; }
+
+    // Calls _job(member) for every member of the team, member 0 being the calling thread
+    template <typename Job>
+    void run(const Job& _job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &_job;
+            invoke = [](const void* job, size_t member) { (*static_cast<const Job*>(job))(member); };
+            running = workers.size();
+            epoch++;
+        }
+        start.notify_all();
+        _job(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return running == 0; });
+    }
+};
+
+#endif